@@ -0,0 +1,60 @@
+/*
+ * adt7420_array.h
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+#ifndef ADT7420_ARRAY_H_
+#define ADT7420_ARRAY_H_
+
+#include "main.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "adt7420_driver.h"
+#include "i2c_bus.h"
+#include "dwt_timer.h"
+
+// A0 & A1 jumpers give the four addresses 0x48 - 0x4B, channel n is the sensor at base + n
+#define ADT7420_ARRAY_MAX_SENSORS 4U
+#define ADT7420_ARRAY_BASE_ADDR (uint8_t)0x48U
+
+// One multi channel reading, every present sensor sampled in a single chained bus transaction
+typedef struct {
+	uint32_t timestamp; // DWT cycle count at the start of the sweep
+	uint32_t sweep_cycles;
+	uint8_t valid; // One bit per channel holding a fresh sample
+	bool over_budget;
+	uint32_t trigger_skew_cycles; // First to last one shot trigger ahead of this sweep, 0 if it followed none
+	adt7420_sample samples[ADT7420_ARRAY_MAX_SENSORS];
+} adt7420_array_record;
+
+typedef struct {
+	adt7420_dev sensors[ADT7420_ARRAY_MAX_SENSORS];
+	i2c_bus* bus;
+	uint8_t present; // One bit per channel that answered with the ADT7420 chip ID
+	uint32_t budget_cycles; // 0 for no limit
+	uint32_t start_cycles;
+	volatile uint32_t end_cycles;
+	volatile uint8_t n_triggered; // One shot writes acknowledged so far in the current group trigger
+	volatile uint32_t trigger_first_cycles;
+	volatile uint32_t trigger_last_cycles;
+	uint32_t trigger_skew_cycles;
+} adt7420_array;
+
+Adt7420_status adt7420_array_init(adt7420_array* array, i2c_bus* bus, adt7420_settings* params);
+void adt7420_array_set_budget_us(adt7420_array* array, uint32_t budget_us);
+Adt7420_status adt7420_array_start_sweep(adt7420_array* array);
+bool adt7420_array_sweep_done(adt7420_array* array);
+Adt7420_status adt7420_array_complete_sweep(adt7420_array* array, adt7420_array_record* record);
+// Starts a one shot conversion on every present sensor back to back in one transaction, so they sample together,
+// sweep_done tells when the triggers are out & a sweep once ADT7420_ONE_SHOT_CONVERSION_MS has passed gathers the results
+Adt7420_status adt7420_array_start_trigger(adt7420_array* array);
+Adt7420_status adt7420_array_complete_trigger(adt7420_array* array, uint32_t* skew_cycles);
+
+static inline bool adt7420_array_is_present(adt7420_array* array, uint8_t channel)
+{
+	return (array->present >> channel) & 1U;
+}
+
+#endif
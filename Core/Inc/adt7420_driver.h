@@ -10,15 +10,21 @@
 
 #include "main.h"
 #include "stdint.h"
+#include "stdbool.h"
+#include "i2c_bus.h"
 
 
 #define ADT7420_CHIP_ID (uint8_t)0xCB
 #define ADT7420_REG_SIZE (uint8_t)1U
+#define ADT7420_NUM_REGS (uint8_t)12U
+#define ADT7420_XFER_BUF_SIZE (uint8_t)(ADT7420_NUM_REGS + 1U) // Register pointer + whole register map
 
 #define ADT7420_MIN_TEMPERATURE_C (int16_t)-40
 #define ADT7420_MAX_TEMPERATURE_C (int16_t)150
 #define ADT7420_MIN_HYSTERESIS_C (int16_t)0
 #define ADT7420_MAX_HYSTERESIS_C (int16_t)15
+#define ADT7420_MIN_TEMPERATURE_MDEG ((int32_t)ADT7420_MIN_TEMPERATURE_C * 1000)
+#define ADT7420_MAX_TEMPERATURE_MDEG ((int32_t)ADT7420_MAX_TEMPERATURE_C * 1000)
 #define ADT7420_CELS_TO_FAHR(celsius) ((celsius * (9 / 5)) + 32)
 #define ADT7420_FAHR_TO_CELS(fahr) ((fahr - 32) * (9 / 5))
 
@@ -42,33 +48,68 @@
 #define ADT7420_HYSTERESIS (uint8_t)0x0AU
 
 // Config register flag bits
-#define ADT7420_FAULT_QUEUE_1 (uint8_t)0x1U
-#define ADT7420_FAULT_QUEUE_2 (uint8_t)0x2U
-#define ADT7420_FAULT_QUEUE_3 (uint8_t)0x3U
-#define ADT7420_FAULT_QUEUE_4 (uint8_t)0x4U
+#define ADT7420_FAULT_QUEUE_1 (uint8_t)0x0U
+#define ADT7420_FAULT_QUEUE_2 (uint8_t)0x1U
+#define ADT7420_FAULT_QUEUE_3 (uint8_t)0x2U
+#define ADT7420_FAULT_QUEUE_4 (uint8_t)0x3U
 
 #define ADT7420_CT_ACTIVE_LOW (uint8_t)0x0U
-#define ADT7420_CT_ACTIVE_HIGH (uint8_t)0x8U
+#define ADT7420_CT_ACTIVE_HIGH (uint8_t)0x4U
 #define ADT7420_INT_ACTIVE_LOW (uint8_t)0x0U
-#define ADT7420_INT_ACTIVE_HIGH (uint8_t)0x10U
+#define ADT7420_INT_ACTIVE_HIGH (uint8_t)0x8U
 
 #define ADT7420_INT_MODE (uint8_t)0x0U
-#define ADT7420_COMP_MODE (uint8_t)0x20U
+#define ADT7420_COMP_MODE (uint8_t)0x10U
 
 #define ADT7420_CONTINUOUS_MODE (uint8_t)0x00U
-#define ADT7420_ONE_SHOT_MODE (uint8_t)0x40U
-#define ADT7420_SPS_MODE (uint8_t)0x60U
-#define ADT7420_SHUTDOWN_MODE (uint8_t)0xA0U
+#define ADT7420_ONE_SHOT_MODE (uint8_t)0x20U
+#define ADT7420_SPS_MODE (uint8_t)0x40U
+#define ADT7420_SHUTDOWN_MODE (uint8_t)0x60U
+#define ADT7420_OP_MODE_MASK (uint8_t)0x60U
 
 #define ADT7420_13_BIT_RES (uint8_t)0x00U
 #define ADT7420_16_BIT_RES (uint8_t)0x80U
 
+// Deadline for one polled transfer, a full 13 byte register map at 100kHz is ~1.5ms
+#define ADT7420_I2C_TIMEOUT_US 5000U
+
+// Worst case conversion times, one shot powers up, converts & drops back into shutdown
+#define ADT7420_ONE_SHOT_CONVERSION_MS 240U
+#define ADT7420_SPS_PERIOD_MS 1000U
+
+// Status register flag bits, RDY is active low & clears once a new conversion result is available
+#define ADT7420_STATUS_T_LOW (uint8_t)0x10U
+#define ADT7420_STATUS_T_HIGH (uint8_t)0x20U
+#define ADT7420_STATUS_T_CRIT (uint8_t)0x40U
+#define ADT7420_STATUS_RDY (uint8_t)0x80U
+
+// Config, thresholds & hysteresis (0x03 - 0x0A) are contiguous & programmed as one register image
+#define ADT7420_CONFIG_BANK_SIZE (uint8_t)8U
+#define ADT7420_CONFIG_BANK_IDX(reg) ((reg) - ADT7420_CONFIG)
+#define ADT7420_HYSTERESIS_MASK (uint8_t)0x0FU
+
+// Power on register image, also what the sensor drops back to after ADT7420_RESET
+#define ADT7420_DEFAULT_CONFIG (uint8_t)0x00U
+#define ADT7420_DEFAULT_HIGH (uint16_t)0x2000U // 64C
+#define ADT7420_DEFAULT_LOW (uint16_t)0x0500U // 10C
+#define ADT7420_DEFAULT_CRIT (uint16_t)0x4980U // 147C
+#define ADT7420_DEFAULT_HYSTERESIS (uint8_t)0x05U
+// The sensor ignores the bus while it reloads its registers after a software reset
+#define ADT7420_RESET_US 200U
+
+// Temperature MSB, LSB & status are contiguous so a sample is a single auto-increment read
+#define ADT7420_SAMPLE_SIZE (uint8_t)3U
+
 
 typedef enum {
 	ADT7420_OK,
 	ADT7420_INVALID_ADDR,
 	ADT7420_INVALID_SETTING,
-	ADT7420_I2C_ERROR
+	ADT7420_I2C_ERROR,
+	ADT7420_BUSY,
+	ADT7420_I2C_NACK,
+	ADT7420_I2C_TIMEOUT,
+	ADT7420_I2C_ARB_LOST
 } Adt7420_status;
 
 typedef struct {
@@ -79,31 +120,138 @@ typedef struct {
 	int16_t hysteresis;
 } adt7420_settings;
 
+// Whole register map 0x00 - 0x0B in address order, moved in & out of the sensor as one burst
+typedef struct __attribute__((packed)) {
+	uint8_t temperature_msb;
+	uint8_t temperature_lsb;
+	uint8_t status;
+	uint8_t config;
+	uint8_t high_msb;
+	uint8_t high_lsb;
+	uint8_t low_msb;
+	uint8_t low_lsb;
+	uint8_t crit_msb;
+	uint8_t crit_lsb;
+	uint8_t hysteresis;
+	uint8_t id;
+} adt7420_reg_map;
+
+_Static_assert(sizeof(adt7420_reg_map) == ADT7420_NUM_REGS, "adt7420_reg_map must mirror the register map");
+
+// Sample decoding for one conversion resolution, picked once per device from its config
+typedef struct {
+	float (*to_celsius)(uint16_t adc_code);
+	int32_t (*to_mdeg)(uint16_t adc_code);
+} adt7420_decoder;
+
+typedef struct {
+	float temperature_c;
+	int32_t temperature_mdeg;
+	uint8_t status;
+	bool t_crit;
+	bool t_high;
+	bool t_low;
+	bool ready;
+} adt7420_sample;
+
+typedef enum {
+	ADT7420_SAMPLER_IDLE,
+	ADT7420_SAMPLER_CONVERTING
+} Adt7420_sampler_state;
+
 typedef struct {
 	I2C_TypeDef* i2c_ch;
 	GPIO_TypeDef* int_port;
 	uint8_t i2c_addr;
 	uint32_t int_pin;
 	uint32_t ct_pin;
+	i2c_bus* bus; // Needed for the submit/complete calls, once set the blocking calls are queued through it too
+	i2c_bus* recovery; // Polled calls only, its pins clock a stuck bus free, NULL to only reset the peripheral
+	i2c_xfer xfer;
+	uint8_t tx_buf[ADT7420_XFER_BUF_SIZE];
+	uint8_t rx_buf[ADT7420_XFER_BUF_SIZE];
+	uint8_t shadow[ADT7420_CONFIG_BANK_SIZE]; // RAM copy of the writable registers 0x03 - 0x0A
+	uint8_t dirty; // One bit per shadow register not yet written to the sensor
+	uint8_t synced_config; // Config as the sensor holds it, what the INT & CT pins follow while the shadow is dirty
+	const adt7420_decoder* decoder;
+	int32_t track_delta_mdeg; // Half width of the tracking threshold window, 0 when not tracking
+	int32_t track_center_mdeg;
+	i2c_stats stats; // Every transaction to this sensor, polled or through the bus
 } adt7420_dev;
 
+// Low power sampling, the sensor sits in shutdown (one shot) or 1 SPS mode between samples
+typedef struct {
+	adt7420_dev* dev;
+	uint8_t mode;
+	uint32_t period_ms;
+	Adt7420_sampler_state state;
+} adt7420_sampler;
+
 Adt7420_status adt7420_write_one_reg(adt7420_dev* dev, uint8_t reg, uint8_t data);
 Adt7420_status adt7420_read_one_reg(adt7420_dev* dev, uint8_t reg, uint8_t* data);
 Adt7420_status adt7420_write_two_reg(adt7420_dev* dev, uint8_t reg, uint16_t data);
 Adt7420_status adt7420_read_two_reg(adt7420_dev* dev, uint8_t reg, uint16_t* data);
+Adt7420_status adt7420_read_burst(adt7420_dev* dev, uint8_t reg, uint8_t* data, uint8_t n_bytes);
+Adt7420_status adt7420_write_burst(adt7420_dev* dev, uint8_t reg, uint8_t* data, uint8_t n_bytes);
+Adt7420_status adt7420_submit_read_two_reg(adt7420_dev* dev, uint8_t reg);
+Adt7420_status adt7420_submit_write_two_reg(adt7420_dev* dev, uint8_t reg, uint16_t data);
+bool adt7420_xfer_complete(adt7420_dev* dev);
+Adt7420_status adt7420_complete_read_two_reg(adt7420_dev* dev, uint16_t* data);
+Adt7420_status adt7420_complete_write_two_reg(adt7420_dev* dev);
+Adt7420_status adt7420_submit_read_burst(adt7420_dev* dev, uint8_t reg, uint8_t n_bytes);
+Adt7420_status adt7420_submit_write_burst(adt7420_dev* dev, uint8_t reg, uint8_t* data, uint8_t n_bytes);
+Adt7420_status adt7420_complete_read_burst(adt7420_dev* dev, uint8_t* data, uint8_t n_bytes);
 Adt7420_status adt7420_init(adt7420_dev* dev, adt7420_settings* params);
+// Reads the register bank back & only writes what differs, for a sensor that kept its settings across an MCU reset
+Adt7420_status adt7420_warm_init(adt7420_dev* dev, adt7420_settings* params);
+Adt7420_status adt7420_reset(adt7420_dev* dev);
+// Snapshot of every register from one read, restore writes the config bank (0x03 - 0x0A) back in one burst
+Adt7420_status adt7420_dump_registers(adt7420_dev* dev, adt7420_reg_map* map);
+Adt7420_status adt7420_restore_registers(adt7420_dev* dev, const adt7420_reg_map* map);
 Adt7420_status adt7420_on(adt7420_dev* dev);
 Adt7420_status adt7420_shutdown(adt7420_dev* dev);
 Adt7420_status adt7420_get_status(adt7420_dev* dev, uint8_t* status);
 Adt7420_status adt7420_get_config(adt7420_dev* dev, uint8_t* config);
 Adt7420_status adt7420_get_temperature(adt7420_dev* dev, float* temp_c);
+Adt7420_status adt7420_get_temperature_mdeg(adt7420_dev* dev, int32_t* temperature_mdeg);
+Adt7420_status adt7420_submit_get_temperature(adt7420_dev* dev);
+Adt7420_status adt7420_complete_get_temperature(adt7420_dev* dev, float* temp_c);
+Adt7420_status adt7420_get_sample(adt7420_dev* dev, adt7420_sample* sample);
+Adt7420_status adt7420_submit_get_sample(adt7420_dev* dev);
+// Sets up the sample read without starting it, so several sensors can be chained into one bus transaction
+i2c_xfer* adt7420_prepare_get_sample(adt7420_dev* dev);
+Adt7420_status adt7420_complete_get_sample(adt7420_dev* dev, adt7420_sample* sample);
 Adt7420_status adt7420_get_low_temperature_c(adt7420_dev* dev, float* temperature_c);
 Adt7420_status adt7420_get_high_temperature_c(adt7420_dev* dev, float* temperature_c);
 Adt7420_status adt7420_get_crit_temperature_c(adt7420_dev* dev, float* temperature_c);
 Adt7420_status adt7420_get_hysteresis(adt7420_dev* dev, float* hysteresis_c);
+Adt7420_status adt7420_get_low_temperature_mdeg(adt7420_dev* dev, int32_t* temperature_mdeg);
+Adt7420_status adt7420_get_high_temperature_mdeg(adt7420_dev* dev, int32_t* temperature_mdeg);
+Adt7420_status adt7420_get_crit_temperature_mdeg(adt7420_dev* dev, int32_t* temperature_mdeg);
 Adt7420_status adt7420_set_config(adt7420_dev* dev, uint8_t config);
 Adt7420_status adt7420_set_low_temperature_c(adt7420_dev* dev, int16_t temperature_c);
 Adt7420_status adt7420_set_high_temperature_c(adt7420_dev* dev, int16_t temperature_c);
 Adt7420_status adt7420_set_crit_temperature_c(adt7420_dev* dev, int16_t temperature_c);
 Adt7420_status adt7420_set_hysteresis(adt7420_dev* dev, int16_t hysteresis_c);
+Adt7420_status adt7420_set_low_temperature_mdeg(adt7420_dev* dev, int32_t temperature_mdeg);
+Adt7420_status adt7420_set_high_temperature_mdeg(adt7420_dev* dev, int32_t temperature_mdeg);
+Adt7420_status adt7420_set_crit_temperature_mdeg(adt7420_dev* dev, int32_t temperature_mdeg);
+// adt7420_on/shutdown & the setters only update the register shadow, sync writes the changes out
+Adt7420_status adt7420_sync(adt7420_dev* dev);
+bool adt7420_is_dirty(adt7420_dev* dev);
+bool adt7420_int_asserted(adt7420_dev* dev);
+// Tracking takes over T_HYST (0) as well as T_HIGH & T_LOW, so it also drops the T_CRIT hysteresis until disabled
+Adt7420_status adt7420_track_enable(adt7420_dev* dev, int32_t delta_mdeg);
+Adt7420_status adt7420_track_update(adt7420_dev* dev, int32_t temperature_mdeg);
+void adt7420_track_disable(adt7420_dev* dev);
+Adt7420_status adt7420_set_operation_mode(adt7420_dev* dev, uint8_t mode);
+Adt7420_status adt7420_trigger_one_shot(adt7420_dev* dev);
+// Sets up the one shot config write without starting it, so several sensors can be triggered in one bus transaction
+i2c_xfer* adt7420_prepare_trigger_one_shot(adt7420_dev* dev);
+Adt7420_status adt7420_complete_trigger_one_shot(adt7420_dev* dev);
+Adt7420_status adt7420_sampler_init(adt7420_sampler* sampler, adt7420_dev* dev, uint8_t mode, uint32_t period_ms);
+Adt7420_status adt7420_sampler_step(adt7420_sampler* sampler, adt7420_sample* sample, uint32_t* next_ms);
+bool adt7420_ct_asserted(adt7420_dev* dev);
+void adt7420_get_stats(adt7420_dev* dev, i2c_stats* stats);
+void adt7420_reset_stats(adt7420_dev* dev);
 #endif
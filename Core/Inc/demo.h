@@ -10,6 +10,9 @@
 #include "ring_buffer.h"
 #include "stdbool.h"
 #include "hd44780u_driver.h"
+#include "i2c_bus.h"
+#include "adt7420_array.h"
+#include "dwt_timer.h"
 
 // Enter sleep mode with wake from interrupt, and keep flash on
 #define SLEEP_MODE() {\
@@ -18,11 +21,31 @@
 	__WFI(); \
 }
 
+// INT only fires once the temperature moves this far from the last reading
+#define ADT7420_TRACK_DELTA_MDEG 500
+
+// Set to 1 for battery powered nodes, the sensor is then kept in shutdown & woken for one shot conversions
+// by timer 2, instead of converting continuously with the tracking threshold window
+#define ADT7420_LOW_POWER_SAMPLING 0
+#define ADT7420_SAMPLE_PERIOD_MS 10000U
+
+// Four sensors at ~400kHz take ~0.6ms, anything past this is flagged in the log
+#define ADT7420_SWEEP_BUDGET_US 1000U
+// SMBus style limit, longer than any transfer the demo makes
+#define I2C_BUS_TIMEOUT_US 25000U
+// I2C1 runs from the 16MHz MSI, fast mode is 0x00610611 (~398kHz with the spec's worst case rise & fall). Fast mode
+// plus would give ~917kHz, but the ADT7420 tops out at 400kHz
+#define I2C_BUS_SPEED I2C_SPEED_FAST
+
 extern ring_buffer usart_tx_buf;
+extern i2c_bus i2c1_bus;
+extern hd44780u display;
 extern volatile bool timer2_overflow_flag;
+extern volatile bool adt7420_alarm_flag;
 
 void sys_init(void);
 void hd44780u_config(void);
 void adt7420_config(void);
-void read_adt7420(void);
+// timer_tick is false when only an INT/CT edge woke the main loop
+void read_adt7420(bool timer_tick);
 void usart_log_temperature(char* str);
@@ -0,0 +1,70 @@
+/*
+ * dwt_timer.h
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+#ifndef DWT_TIMER_H_
+#define DWT_TIMER_H_
+
+#include "main.h"
+#include <stdint.h>
+
+static inline void dwt_timer_init(void);
+static inline uint32_t dwt_timer_cycles(void);
+static inline uint32_t dwt_timer_elapsed(uint32_t start);
+static inline uint32_t dwt_timer_us_to_cycles(uint32_t us);
+static inline uint32_t dwt_timer_cycles_to_us(uint32_t cycles);
+static inline uint32_t dwt_timer_ns_to_cycles(uint32_t ns);
+static inline void dwt_timer_delay_cycles(uint32_t cycles);
+static inline void dwt_timer_delay_us(uint32_t us);
+
+
+static inline void dwt_timer_init(void)
+{
+	// Cycle counter sits in the trace block, which has to be powered up first
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static inline uint32_t dwt_timer_cycles(void)
+{
+	return DWT->CYCCNT;
+}
+
+static inline uint32_t dwt_timer_elapsed(uint32_t start)
+{
+	// Unsigned subtraction stays correct across a single counter wrap
+	return DWT->CYCCNT - start;
+}
+
+static inline uint32_t dwt_timer_us_to_cycles(uint32_t us)
+{
+	return us * (SystemCoreClock / 1000000U);
+}
+
+static inline uint32_t dwt_timer_cycles_to_us(uint32_t cycles)
+{
+	return cycles / (SystemCoreClock / 1000000U);
+}
+
+static inline uint32_t dwt_timer_ns_to_cycles(uint32_t ns)
+{
+	// Rounded up, a sub microsecond minimum still has to be met at low clock speeds
+	return ((ns * (SystemCoreClock / 1000000U)) + 999U) / 1000U;
+}
+
+static inline void dwt_timer_delay_cycles(uint32_t cycles)
+{
+	uint32_t start = DWT->CYCCNT;
+	while ((DWT->CYCCNT - start) < cycles);
+}
+
+static inline void dwt_timer_delay_us(uint32_t us)
+{
+	dwt_timer_delay_cycles(dwt_timer_us_to_cycles(us));
+}
+
+#endif
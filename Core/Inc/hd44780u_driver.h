@@ -12,6 +12,7 @@
 #include "stdint.h"
 #include "stddef.h"
 #include "stdbool.h"
+#include "dwt_timer.h"
 
 // HD44780U INSTRUCTION SET
 #define HD44780U_DISPLAY_CLEAR (uint8_t)0x1U
@@ -58,16 +59,42 @@
 #define HD44780U_MIN_DDRAM_ADDR (uint8_t)0x0U
 #define HD44780U_MAX_DDRAM_ADDR (uint8_t)0x67U
 
+// Bus & execution timings for a 3V supply, the DWT cycle counter has to be running before init
+#define HD44780U_EN_PULSE_NS 450U
+#define HD44780U_EN_CYCLE_NS 1000U
+#define HD44780U_EXEC_US 37U
+#define HD44780U_CLEAR_HOME_US 1520U
+#define HD44780U_POWER_ON_MS 100U
+#define HD44780U_INIT_FIRST_US 4100U
+#define HD44780U_INIT_SECOND_US 100U
+// Busy flag reads, data valid after EN rises & the address counter lags the busy flag clearing
+#define HD44780U_ADDR_SETUP_NS 60U
+#define HD44780U_DATA_DELAY_NS 360U
+#define HD44780U_ADDR_UPDATE_US 4U
+#define HD44780U_BUSY_TIMEOUT_US 3000U
+#define HD44780U_BUSY_FLAG (uint8_t)0x80U
+#define HD44780U_ADDR_MASK (uint8_t)0x7FU
+
+// Background queue, room for a full redraw of both rows with plenty to spare
+#define HD44780U_QUEUE_SIZE 64U
+#define HD44780U_QUEUE_DATA (uint16_t)0x100U // RS high, entry is a character rather than a command
+
+// D4 - D7 BSRR words, one per nibble value
+#define HD44780U_NIBBLE_VALUES 16U
+
 // Display position constants
 #define HD44780U_MAX_ROW_POS (uint8_t)0x1U
 #define HD44780U_MAX_COL_POS (uint8_t)0xFU
+#define HD44780U_NUM_ROWS (HD44780U_MAX_ROW_POS + 1U)
+#define HD44780U_NUM_COLS (HD44780U_MAX_COL_POS + 1U)
 
 
 // Typedefs
 typedef enum {
 	HD44780U_OK,
 	HD44780U_INVALID_FLAGS,
-	HD44780U_INVALID_DISPLAY_POS
+	HD44780U_INVALID_DISPLAY_POS,
+	HD44780U_NO_RW_PIN
 } Hd44780u_status;
 
 typedef struct {
@@ -79,12 +106,20 @@ typedef struct {
 	GPIO_TypeDef* port;
 	uint32_t en_pin;
 	uint32_t rs_pin;
+	uint32_t rw_pin; // 0 when R/W is tied to ground, commands then wait out fixed execution times instead
 	uint32_t d4_pin;
 	uint32_t d5_pin;
 	uint32_t d6_pin;
 	uint32_t d7_pin;
+	uint32_t nibble_bsrr[HD44780U_NIBBLE_VALUES]; // Built by init from the data pins, which all have to be on the one port
 	hd44780u_cursor cursor;
 	uint8_t display_status;
+	uint8_t frame[HD44780U_NUM_ROWS][HD44780U_NUM_COLS]; // What the display should show, written by the fb calls
+	uint8_t shown[HD44780U_NUM_ROWS][HD44780U_NUM_COLS]; // What DDRAM currently holds
+	TIM_TypeDef* tim; // NULL to write synchronously, otherwise writes are queued & sent from its update interrupt
+	uint16_t queue[HD44780U_QUEUE_SIZE];
+	volatile uint8_t queue_head;
+	volatile uint8_t queue_tail;
 } hd44780u;
 
 // Function prototypes
@@ -92,6 +127,14 @@ void hd44780u_init(hd44780u* display);
 void hd44780u_write_nibble(hd44780u* display, uint8_t nibble);
 void hd44780u_write_command(hd44780u* display, uint8_t command);
 void hd44780u_write_data(hd44780u* display, uint8_t addr);
+// Once attached, every write just queues & the timer sends one entry per execution time, it has to tick at 1MHz
+// & be counting, its update interrupt calls the irq handler. Writes mustn't be made with interrupts masked
+void hd44780u_attach_timer(hd44780u* display, TIM_TypeDef* tim);
+bool hd44780u_queue_empty(hd44780u* display);
+void hd44780u_timer_irq_handler(hd44780u* display);
+// Busy flag & address counter, only readable with rw_pin fitted
+uint8_t hd44780u_read_status(hd44780u* display);
+Hd44780u_status hd44780u_get_address(hd44780u* display, uint8_t* addr);
 Hd44780u_status hd44780u_display_on(hd44780u* display, uint8_t cursor_flags);
 void hd44780u_display_off(hd44780u* display);
 void hd44780u_display_clear(hd44780u* display);
@@ -104,4 +147,9 @@ Hd44780u_status hd44780u_shift_cursor(hd44780u* display, uint8_t direction);
 Hd44780u_status hd44780u_set_cursor(hd44780u* display, uint8_t row, uint8_t col);
 Hd44780u_status hd44780u_put_char(hd44780u* display, uint8_t c);
 Hd44780u_status hd44780u_put_str(hd44780u* display, char *str, size_t len);
+// Framebuffer writes only touch RAM, commit sends the cells that changed since the last one
+Hd44780u_status hd44780u_fb_put_str(hd44780u* display, uint8_t row, uint8_t col, const char* str, size_t len);
+Hd44780u_status hd44780u_fb_put_line(hd44780u* display, uint8_t row, const char* str);
+void hd44780u_fb_clear(hd44780u* display);
+void hd44780u_fb_commit(hd44780u* display);
 #endif /* INC_HD44780U_DRIVER_H_ */
@@ -0,0 +1,174 @@
+/*
+ * i2c_bus.h
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+#ifndef I2C_BUS_H_
+#define I2C_BUS_H_
+
+#include "main.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "stddef.h"
+#include "dwt_timer.h"
+
+// NBYTES is 8 bits, longer segments are split & continued with RELOAD
+#define I2C_BUS_MAX_NBYTES 255U
+
+// General call & reserved addresses are never probed, a scan range is clamped to these
+#define I2C_BUS_ADDR_MIN (uint8_t)0x08U
+#define I2C_BUS_ADDR_MAX (uint8_t)0x77U
+#define I2C_BUS_SCAN_BATCH 8U
+
+// TIMEOUTA counts in 2048 I2C kernel clock steps, 12 bits wide
+#define I2C_BUS_TIMEOUTA_STEP 2048U
+#define I2C_BUS_TIMEOUTA_MAX 0xFFFU
+// Enough clocks to finish any byte a slave was part way through sending when the master lost track
+#define I2C_BUS_RECOVERY_CLOCKS 9U
+#define I2C_BUS_RECOVERY_HALF_PERIOD_US 5U // 100kHz
+// DMA takes RXDR within a few AHB clocks, a channel that hasn't by now has stalled
+#define I2C_BUS_DMA_DRAIN_US 10U
+// Deadline timer ticks at 1MHz with a 16 bit ARR, longer deadlines take more than one lap
+#define I2C_BUS_DEADLINE_MAX_US 0x10000U
+
+// TIMINGR field limits
+#define I2C_BUS_PRESC_MAX 15U
+#define I2C_BUS_SCLDEL_MAX 15U
+#define I2C_BUS_SDADEL_MAX 15U
+#define I2C_BUS_SCLH_MAX 255U
+#define I2C_BUS_SCLL_MAX 255U
+// Analog filter delay range, the filter is left on & the digital filter off
+#define I2C_BUS_TAF_MIN_NS 50U
+#define I2C_BUS_TAF_MAX_NS 260U
+#define I2C_BUS_DNF 0U
+
+typedef enum {
+	I2C_OK,
+	I2C_PENDING,
+	I2C_BUSY,
+	I2C_NACK,
+	I2C_BUS_ERROR,
+	I2C_TIMEOUT,
+	I2C_ARB_LOST
+} I2c_status;
+
+typedef enum {
+	I2C_SPEED_STANDARD, // 100kHz
+	I2C_SPEED_FAST, // 400kHz
+	I2C_SPEED_FAST_PLUS, // 1MHz
+	I2C_NUM_SPEEDS
+} I2c_speed;
+
+typedef enum {
+	I2C_PHASE_WRITE,
+	I2C_PHASE_READ
+} I2c_phase;
+
+// Queued transfers are started highest priority first, in submission order within a priority
+typedef enum {
+	I2C_PRIORITY_ALARM,
+	I2C_PRIORITY_SAMPLE,
+	I2C_PRIORITY_CONFIG,
+	I2C_NUM_PRIORITIES
+} I2c_priority;
+
+// Transaction counters & DWT cycle latencies, per bus & optionally per device
+typedef struct {
+	uint32_t transfers;
+	uint32_t nacks;
+	uint32_t timeouts;
+	uint32_t arb_losts;
+	uint32_t bus_errors;
+	uint32_t retries;
+	uint32_t min_cycles;
+	uint32_t max_cycles;
+	uint64_t total_cycles;
+} i2c_stats;
+
+typedef struct i2c_xfer i2c_xfer;
+typedef void (*i2c_xfer_callback)(i2c_xfer* xfer);
+
+// A single write, read or write-then-read (repeated start) transaction, with no data at all it's an address only
+// probe that just checks for an ACK. Transactions linked through
+// next are submitted as one chain, each following the last with a repeated start & only one STOP at the end
+struct i2c_xfer {
+	uint8_t addr;
+	uint8_t* tx_buf;
+	uint16_t tx_len;
+	uint8_t* rx_buf;
+	uint16_t rx_len;
+	volatile I2c_status status;
+	i2c_xfer_callback callback; // Optional, called from the I2C ISR on completion
+	void* ctx;
+	i2c_xfer* next;
+	I2c_priority priority;
+	i2c_xfer* queue_next; // Owned by the bus while queued
+	i2c_stats* stats; // Optional, updated alongside the bus stats
+};
+
+typedef struct {
+	I2C_TypeDef* i2c_ch;
+	i2c_xfer* volatile active;
+	volatile I2c_phase phase;
+	volatile I2c_status result;
+	uint16_t tx_idx;
+	uint16_t rx_idx;
+	uint16_t reload_len; // Bytes of the current segment still to be loaded into NBYTES
+	DMA_TypeDef* dma; // NULL when data bytes are moved by the ISR instead of DMA
+	uint32_t dma_tx_ch;
+	uint32_t dma_rx_ch;
+	i2c_xfer* queue_head[I2C_NUM_PRIORITIES];
+	i2c_xfer* queue_tail[I2C_NUM_PRIORITIES];
+	I2c_speed speed;
+	uint32_t timeout_us;
+	uint32_t timeout_cycles; // Whole transfer deadline, 0 when timeouts are off
+	uint32_t start_cycles;
+	bool retried; // Active link has already had its one retry after a recovery
+	volatile bool recover_pending; // Set by the ISRs, the recovery itself runs from i2c_bus_check_timeout
+	bool recovering;
+	TIM_TypeDef* deadline_tim; // NULL if only i2c_bus_check_timeout ever notices a missed deadline
+	GPIO_TypeDef* scl_port; // NULL if recovery is just a peripheral reset, SCL & SDA must share a port
+	uint32_t scl_pin;
+	uint32_t sda_pin;
+	i2c_stats stats;
+} i2c_bus;
+
+void i2c_bus_init(i2c_bus* bus, I2C_TypeDef* i2c_ch);
+void i2c_bus_enable_dma(i2c_bus* bus, DMA_TypeDef* dma, uint32_t tx_ch, uint32_t rx_ch, uint32_t request);
+void i2c_bus_disable_dma(i2c_bus* bus);
+// Safe from the main loop & ISRs, the transfer starts now if the bus is free or is queued by priority
+I2c_status i2c_bus_submit(i2c_bus* bus, i2c_xfer* xfer);
+bool i2c_bus_idle(i2c_bus* bus);
+void i2c_bus_set_timeout(i2c_bus* bus, uint32_t timeout_us);
+// Basic timer ticking at 1MHz, its update interrupt fails a transfer at the deadline even with nothing polling
+// & wakes the core so the recovery can run. Give it the I2C interrupts' priority
+void i2c_bus_set_deadline_timer(i2c_bus* bus, TIM_TypeDef* tim);
+// Recomputes TIMINGR & TIMEOUTR from the current I2C kernel clock, so call it again after a clock change
+I2c_status i2c_bus_set_speed(i2c_bus* bus, I2c_speed speed);
+// Pure calculation, 0 if the clock is too slow for the speed to beat the next one down (fast mode plus needs ~4MHz)
+uint32_t i2c_bus_compute_timing(uint32_t i2c_clk_hz, I2c_speed speed);
+void i2c_bus_set_recovery_pins(i2c_bus* bus, GPIO_TypeDef* port, uint32_t scl_pin, uint32_t sda_pin);
+I2c_status i2c_bus_recover(i2c_bus* bus);
+// Called by anything waiting on a transfer, from thread context only. Fails one that has run past its deadline
+// & runs the bus recovery the ISRs leave pending, since that bit bangs the pins with busy waits
+void i2c_bus_check_timeout(i2c_bus* bus);
+I2c_status i2c_bus_take_errors(I2C_TypeDef* i2c_ch);
+// Blocking, fills found with the addresses that ACK & returns how many did. The range is clamped to 0x08 - 0x77
+uint8_t i2c_bus_scan(i2c_bus* bus, uint8_t first_addr, uint8_t last_addr, uint8_t* found, uint8_t max_found);
+void i2c_bus_get_stats(i2c_bus* bus, i2c_stats* stats);
+void i2c_stats_reset(i2c_stats* stats);
+void i2c_stats_record(i2c_stats* stats, I2c_status status, uint32_t cycles);
+void i2c_stats_snapshot(i2c_stats* stats, i2c_stats* copy);
+uint32_t i2c_stats_avg_cycles(i2c_stats* stats);
+void i2c_bus_ev_irq_handler(i2c_bus* bus);
+void i2c_bus_er_irq_handler(i2c_bus* bus);
+void i2c_bus_deadline_irq_handler(i2c_bus* bus);
+
+static inline bool i2c_xfer_pending(i2c_xfer* xfer)
+{
+	return xfer->status == I2C_PENDING;
+}
+
+#endif
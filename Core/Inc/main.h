@@ -79,6 +79,12 @@ void usart_log(char* str);
 #define ADT7420_SCL_GPIO_Port GPIOA
 #define ADT7420_SDA_Pin LL_GPIO_PIN_10
 #define ADT7420_SDA_GPIO_Port GPIOA
+#define ADT7420_INT_Pin LL_GPIO_PIN_0
+#define ADT7420_INT_GPIO_Port GPIOA
+#define ADT7420_INT_EXTI_IRQn EXTI0_IRQn
+#define ADT7420_CT_Pin LL_GPIO_PIN_1
+#define ADT7420_CT_GPIO_Port GPIOA
+#define ADT7420_CT_EXTI_IRQn EXTI1_IRQn
 #ifndef NVIC_PRIORITYGROUP_0
 #define NVIC_PRIORITYGROUP_0         ((uint32_t)0x00000007) /*!< 0 bit  for pre-emption priority,
                                                                  4 bits for subpriority */
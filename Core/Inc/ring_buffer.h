@@ -13,7 +13,7 @@
 #include <assert.h>
 #include <string.h>
 
-#define RING_BUFFER_SIZE 16U // Must be a power of 2 for bitwise & masking to work
+#define RING_BUFFER_SIZE 128U // Must be a power of 2 for bitwise & masking to work
 
 typedef struct {
 	volatile uint8_t read;
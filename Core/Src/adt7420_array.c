@@ -0,0 +1,192 @@
+/*
+ * adt7420_array.c
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+#include "adt7420_array.h"
+#include "string.h"
+
+static void adt7420_array_sweep_end(i2c_xfer* xfer);
+static void adt7420_array_trigger_end(i2c_xfer* xfer);
+
+static void adt7420_array_sweep_end(i2c_xfer* xfer)
+{
+	adt7420_array* array = xfer->ctx;
+	array->end_cycles = dwt_timer_cycles();
+}
+
+static void adt7420_array_trigger_end(i2c_xfer* xfer)
+{
+	adt7420_array* array = xfer->ctx;
+	uint32_t now = dwt_timer_cycles();
+
+	// Conversion starts as the config write is acknowledged, so only those count towards the skew
+	if (xfer->status != I2C_OK) {
+		return;
+	}
+	if (array->n_triggered == 0) {
+		array->trigger_first_cycles = now;
+	}
+	array->trigger_last_cycles = now;
+	++array->n_triggered;
+}
+
+Adt7420_status adt7420_array_init(adt7420_array* array, i2c_bus* bus, adt7420_settings* params)
+{
+	uint8_t found[ADT7420_ARRAY_MAX_SENSORS];
+
+	memset(array, 0, sizeof(*array));
+	array->bus = bus;
+
+	// Address only probes of the whole ADT7420 range in one transaction, so empty slots cost ~9 bit times each
+	uint8_t n_found = i2c_bus_scan(bus, ADT7420_ARRAY_BASE_ADDR, ADT7420_ARRAY_BASE_ADDR + ADT7420_ARRAY_MAX_SENSORS - 1U,
+		found, ADT7420_ARRAY_MAX_SENSORS);
+
+	for (uint8_t i = 0; i < n_found; ++i) {
+		uint8_t ch = found[i] - ADT7420_ARRAY_BASE_ADDR;
+		adt7420_dev* dev = &array->sensors[ch];
+		dev->i2c_ch = bus->i2c_ch;
+		dev->i2c_addr = found[i];
+		dev->bus = bus;
+		// Something answered, warm init confirms the chip ID & only rewrites registers that lost their settings,
+		// so after a watchdog or brown-out reset of the MCU alone the sensors usually need no writes at all
+		if (adt7420_warm_init(dev, params) == ADT7420_OK) {
+			array->present |= 1U << ch;
+		}
+	}
+	return array->present ? ADT7420_OK : ADT7420_INVALID_ADDR;
+}
+
+void adt7420_array_set_budget_us(adt7420_array* array, uint32_t budget_us)
+{
+	array->budget_cycles = dwt_timer_us_to_cycles(budget_us);
+}
+
+Adt7420_status adt7420_array_start_sweep(adt7420_array* array)
+{
+	i2c_xfer* first = NULL;
+	i2c_xfer* last = NULL;
+
+	if (!array->present) {
+		return ADT7420_INVALID_ADDR;
+	}
+
+	// Every sample read is linked into one chain, back to back with repeated starts & a single STOP
+	for (uint8_t ch = 0; ch < ADT7420_ARRAY_MAX_SENSORS; ++ch) {
+		if (!adt7420_array_is_present(array, ch)) {
+			continue;
+		}
+		i2c_xfer* xfer = adt7420_prepare_get_sample(&array->sensors[ch]);
+		if (xfer == NULL) {
+			return ADT7420_BUSY;
+		}
+		if (last != NULL) {
+			last->next = xfer;
+		} else {
+			first = xfer;
+		}
+		last = xfer;
+	}
+	// End of the sweep is timestamped from the ISR as the last read completes
+	last->callback = adt7420_array_sweep_end;
+	last->ctx = array;
+
+	array->start_cycles = dwt_timer_cycles();
+	array->end_cycles = array->start_cycles;
+	if (i2c_bus_submit(array->bus, first) != I2C_OK) {
+		return ADT7420_BUSY;
+	}
+	return ADT7420_OK;
+}
+
+bool adt7420_array_sweep_done(adt7420_array* array)
+{
+	for (uint8_t ch = 0; ch < ADT7420_ARRAY_MAX_SENSORS; ++ch) {
+		if (adt7420_array_is_present(array, ch) && !adt7420_xfer_complete(&array->sensors[ch])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+Adt7420_status adt7420_array_complete_sweep(adt7420_array* array, adt7420_array_record* record)
+{
+	if (!adt7420_array_sweep_done(array)) {
+		return ADT7420_BUSY;
+	}
+
+	record->timestamp = array->start_cycles;
+	record->sweep_cycles = array->end_cycles - array->start_cycles;
+	record->over_budget = array->budget_cycles && record->sweep_cycles > array->budget_cycles;
+	record->valid = 0;
+	record->trigger_skew_cycles = array->trigger_skew_cycles;
+	array->trigger_skew_cycles = 0;
+
+	// A sensor that dropped off the bus only loses its own channel
+	for (uint8_t ch = 0; ch < ADT7420_ARRAY_MAX_SENSORS; ++ch) {
+		if (adt7420_array_is_present(array, ch)
+			&& adt7420_complete_get_sample(&array->sensors[ch], &record->samples[ch]) == ADT7420_OK) {
+			record->valid |= 1U << ch;
+		}
+	}
+	return record->valid ? ADT7420_OK : ADT7420_I2C_ERROR;
+}
+
+Adt7420_status adt7420_array_start_trigger(adt7420_array* array)
+{
+	i2c_xfer* first = NULL;
+	i2c_xfer* last = NULL;
+
+	if (!array->present) {
+		return ADT7420_INVALID_ADDR;
+	}
+
+	// Config writes go out with repeated starts between them, each sensor is a couple of byte times behind the last
+	for (uint8_t ch = 0; ch < ADT7420_ARRAY_MAX_SENSORS; ++ch) {
+		if (!adt7420_array_is_present(array, ch)) {
+			continue;
+		}
+		i2c_xfer* xfer = adt7420_prepare_trigger_one_shot(&array->sensors[ch]);
+		if (xfer == NULL) {
+			return ADT7420_BUSY;
+		}
+		xfer->callback = adt7420_array_trigger_end;
+		xfer->ctx = array;
+		if (last != NULL) {
+			last->next = xfer;
+		} else {
+			first = xfer;
+		}
+		last = xfer;
+	}
+
+	array->n_triggered = 0;
+	if (i2c_bus_submit(array->bus, first) != I2C_OK) {
+		return ADT7420_BUSY;
+	}
+	return ADT7420_OK;
+}
+
+Adt7420_status adt7420_array_complete_trigger(adt7420_array* array, uint32_t* skew_cycles)
+{
+	bool triggered = false;
+
+	if (!adt7420_array_sweep_done(array)) {
+		return ADT7420_BUSY;
+	}
+
+	for (uint8_t ch = 0; ch < ADT7420_ARRAY_MAX_SENSORS; ++ch) {
+		if (adt7420_array_is_present(array, ch)
+			&& adt7420_complete_trigger_one_shot(&array->sensors[ch]) == ADT7420_OK) {
+			triggered = true;
+		}
+	}
+	// Carried into the next sweep's record, so the samples come with how well aligned they were
+	array->trigger_skew_cycles = array->n_triggered ? array->trigger_last_cycles - array->trigger_first_cycles : 0;
+	if (skew_cycles != NULL) {
+		*skew_cycles = array->trigger_skew_cycles;
+	}
+	return triggered ? ADT7420_OK : ADT7420_I2C_ERROR;
+}
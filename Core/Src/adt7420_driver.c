@@ -6,18 +6,41 @@
  */
 
 #include "adt7420_driver.h"
-#include "stdbool.h"
+#include "string.h"
 
 
 static uint16_t adt7420_temperature_to_adc_code(uint8_t config, int16_t temp_c);
-static float adt7420_adc_code_to_temperature(uint16_t adc_code);
-static inline bool adt7420_is_valid_temperature(uint16_t temperature_c, bool hyteresis);
+static float adt7420_decode_13_bit_c(uint16_t adc_code);
+static int32_t adt7420_decode_13_bit_mdeg(uint16_t adc_code);
+static float adt7420_decode_16_bit_c(uint16_t adc_code);
+static int32_t adt7420_decode_16_bit_mdeg(uint16_t adc_code);
+static inline const adt7420_decoder* adt7420_select_decoder(uint8_t config);
+static inline const adt7420_decoder* adt7420_temperature_decoder(adt7420_dev* dev);
+static uint16_t adt7420_mdeg_to_adc_code(int32_t temperature_mdeg);
+static inline bool adt7420_is_valid_temperature(int16_t temperature_c, bool hyteresis);
+static inline bool adt7420_is_valid_mdeg(int32_t temperature_mdeg);
+static inline int32_t adt7420_clamp_mdeg(int32_t temperature_mdeg);
+static Adt7420_status adt7420_read_c(adt7420_dev* dev, uint8_t reg, const adt7420_decoder* decoder, float* temperature_c);
+static Adt7420_status adt7420_read_mdeg(adt7420_dev* dev, uint8_t reg, const adt7420_decoder* decoder, int32_t* temperature_mdeg);
+static Adt7420_status adt7420_set_threshold_mdeg(adt7420_dev* dev, uint8_t reg, int32_t temperature_mdeg);
 static inline bool adt7420_parse_params(adt7420_settings* params);
-static inline void i2c_start_write(I2C_TypeDef* i2c_ch, uint8_t addr, uint8_t n_bytes);
-static inline void i2c_start_read(I2C_TypeDef* i2c_ch, uint8_t addr, uint8_t n_bytes);
-static inline void i2c_stop(I2C_TypeDef* i2c_ch);
-static inline void i2c_write_bytes(I2C_TypeDef* i2c_ch, uint8_t* tx_buf, uint8_t n_bytes);
-static inline void i2c_read_bytes(I2C_TypeDef* i2c_ch, uint8_t* rx_buf, uint8_t n_bytes);
+static void adt7420_prepare(adt7420_dev* dev, uint8_t tx_len, uint8_t rx_len, I2c_priority priority);
+static Adt7420_status adt7420_submit(adt7420_dev* dev, uint8_t tx_len, uint8_t rx_len, I2c_priority priority);
+static inline I2c_priority adt7420_read_priority(uint8_t reg);
+static Adt7420_status adt7420_bus_read(adt7420_dev* dev, uint8_t reg, uint8_t* data, uint8_t n_bytes);
+static Adt7420_status adt7420_bus_write(adt7420_dev* dev, uint8_t reg, uint8_t* data, uint8_t n_bytes);
+static Adt7420_status adt7420_xfer_status(adt7420_dev* dev);
+static void adt7420_decode_sample(const adt7420_decoder* decoder, uint8_t* raw, adt7420_sample* sample);
+static void adt7420_build_config_bank(adt7420_settings* params, uint8_t* bank);
+static void adt7420_load_defaults(adt7420_dev* dev);
+static inline void adt7420_shadow_write(adt7420_dev* dev, uint8_t reg, uint8_t data);
+static inline void adt7420_shadow_write_two(adt7420_dev* dev, uint8_t reg, uint16_t data);
+static inline void i2c_start_write(I2C_TypeDef* i2c_ch, uint8_t addr, uint8_t n_bytes, bool read_follows);
+static inline void i2c_start_read(I2C_TypeDef* i2c_ch, uint8_t addr, uint8_t n_bytes, bool restart);
+static I2c_status i2c_wait(I2C_TypeDef* i2c_ch, uint32_t flag, uint32_t start);
+static I2c_status i2c_transfer(I2C_TypeDef* i2c_ch, uint8_t addr, uint8_t* tx_buf, uint8_t tx_len, uint8_t* rx_buf, uint8_t rx_len);
+static Adt7420_status adt7420_i2c_status(I2c_status status);
+static Adt7420_status adt7420_poll(adt7420_dev* dev, uint8_t* tx_buf, uint8_t tx_len, uint8_t* rx_buf, uint8_t rx_len);
 
 static uint16_t adt7420_temperature_to_adc_code(uint8_t config, int16_t temperature_c)
 {
@@ -42,29 +65,58 @@ static uint16_t adt7420_temperature_to_adc_code(uint8_t config, int16_t temperat
 	return adc_code;
 }
 
-static float adt7420_adc_code_to_temperature(uint16_t adc_code)
+// 13 bit: sign extended code >> 3, 1 LSB = 1/16 C = 62.5 mC
+static float adt7420_decode_13_bit_c(uint16_t adc_code)
 {
-	float temperature_c = 0.0;
-    if ((adc_code & 0x8000)) {
-        if ((adc_code & 0x80)) {
-            temperature_c = (((float)adc_code - 65536) / 128);
-    	} else {
-            adc_code = adc_code >> 3;
-            temperature_c = (((float)adc_code - 8192) / 16);
-        }
-    } else {
-        if ((adc_code & 0x80)){
-            temperature_c = (float)adc_code / 128;
-        } else { 
-            adc_code = adc_code >> 3;
-            temperature_c = ((float)adc_code / 16);
-        }
-     }
-	return temperature_c;
+	return (float)((int16_t)adc_code >> 3) / 16.0f;
 }
 
+static int32_t adt7420_decode_13_bit_mdeg(uint16_t adc_code)
+{
+	return ((int32_t)((int16_t)adc_code >> 3) * 125) / 2;
+}
+
+// 16 bit: sign extended code, 1 LSB = 1/128 C = 7.8125 mC
+static float adt7420_decode_16_bit_c(uint16_t adc_code)
+{
+	return (float)(int16_t)adc_code / 128.0f;
+}
+
+static int32_t adt7420_decode_16_bit_mdeg(uint16_t adc_code)
+{
+	return ((int32_t)(int16_t)adc_code * 125) / 16;
+}
+
+static const adt7420_decoder adt7420_decoder_13_bit = {
+	.to_celsius = adt7420_decode_13_bit_c,
+	.to_mdeg = adt7420_decode_13_bit_mdeg
+};
+
+static const adt7420_decoder adt7420_decoder_16_bit = {
+	.to_celsius = adt7420_decode_16_bit_c,
+	.to_mdeg = adt7420_decode_16_bit_mdeg
+};
+
+static inline const adt7420_decoder* adt7420_select_decoder(uint8_t config)
+{
+	return (config & ADT7420_16_BIT_RES) ? &adt7420_decoder_16_bit : &adt7420_decoder_13_bit;
+}
+
+static inline const adt7420_decoder* adt7420_temperature_decoder(adt7420_dev* dev)
+{
+	// Sensor powers up in 13 bit mode, so that's the safe guess before the config is known
+	return dev->decoder != NULL ? dev->decoder : &adt7420_decoder_13_bit;
+}
+
+static uint16_t adt7420_mdeg_to_adc_code(int32_t temperature_mdeg)
+{
+	// Threshold registers are always 16 bit two's complement, 1/128 C per LSB, rounded to nearest
+	int32_t scaled = temperature_mdeg * 16;
+	scaled += (scaled < 0) ? -62 : 62;
+	return (uint16_t)(int16_t)(scaled / 125);
+}
 
-static inline bool adt7420_is_valid_temperature(uint16_t temperature_c, bool hyteresis)
+static inline bool adt7420_is_valid_temperature(int16_t temperature_c, bool hyteresis)
 {
 	if (!hyteresis) {
 		return temperature_c >= ADT7420_MIN_TEMPERATURE_C && temperature_c <= ADT7420_MAX_TEMPERATURE_C;
@@ -73,6 +125,22 @@ static inline bool adt7420_is_valid_temperature(uint16_t temperature_c, bool hyt
 	}
 }
 
+static inline bool adt7420_is_valid_mdeg(int32_t temperature_mdeg)
+{
+	return temperature_mdeg >= ADT7420_MIN_TEMPERATURE_MDEG && temperature_mdeg <= ADT7420_MAX_TEMPERATURE_MDEG;
+}
+
+static inline int32_t adt7420_clamp_mdeg(int32_t temperature_mdeg)
+{
+	if (temperature_mdeg < ADT7420_MIN_TEMPERATURE_MDEG) {
+		return ADT7420_MIN_TEMPERATURE_MDEG;
+	}
+	if (temperature_mdeg > ADT7420_MAX_TEMPERATURE_MDEG) {
+		return ADT7420_MAX_TEMPERATURE_MDEG;
+	}
+	return temperature_mdeg;
+}
+
 static inline bool adt7420_parse_params(adt7420_settings* params)
 {
 	if (!adt7420_is_valid_temperature(params->crit_temperature_c, false)
@@ -86,103 +154,436 @@ static inline bool adt7420_parse_params(adt7420_settings* params)
 	return true;
 }
 
-static inline void i2c_start_write(I2C_TypeDef* i2c_ch, uint8_t addr, uint8_t n_bytes)
+static void adt7420_decode_sample(const adt7420_decoder* decoder, uint8_t* raw, adt7420_sample* sample)
 {
-	LL_I2C_HandleTransfer(i2c_ch, addr << 1U, LL_I2C_ADDRSLAVE_7BIT, n_bytes, LL_I2C_MODE_SOFTEND, LL_I2C_GENERATE_START_WRITE);
+	uint16_t adc_code = (raw[0] << 8U) | (raw[1] & 0xFFU);
+
+	sample->temperature_c = decoder->to_celsius(adc_code);
+	sample->temperature_mdeg = decoder->to_mdeg(adc_code);
+	sample->status = raw[2];
+	sample->t_crit = (raw[2] & ADT7420_STATUS_T_CRIT) != 0;
+	sample->t_high = (raw[2] & ADT7420_STATUS_T_HIGH) != 0;
+	sample->t_low = (raw[2] & ADT7420_STATUS_T_LOW) != 0;
+	sample->ready = (raw[2] & ADT7420_STATUS_RDY) == 0;
 }
 
-static inline void i2c_start_read(I2C_TypeDef* i2c_ch, uint8_t addr, uint8_t n_bytes)
+static void adt7420_build_config_bank(adt7420_settings* params, uint8_t* bank)
 {
-	LL_I2C_HandleTransfer(i2c_ch, addr << 1U, LL_I2C_ADDRSLAVE_7BIT, n_bytes, LL_I2C_MODE_SOFTEND, LL_I2C_GENERATE_RESTART_7BIT_READ);
+	uint16_t adc_code;
+
+	bank[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)] = params->config;
+
+	adc_code = adt7420_temperature_to_adc_code(params->config, params->high_temperature_c);
+	bank[ADT7420_CONFIG_BANK_IDX(ADT7420_TEMPERATURE_HIGH_MSB)] = adc_code >> 8U;
+	bank[ADT7420_CONFIG_BANK_IDX(ADT7420_TEMPERATURE_HIGH_LSB)] = adc_code & 0xFFU;
+
+	adc_code = adt7420_temperature_to_adc_code(params->config, params->low_temperature_c);
+	bank[ADT7420_CONFIG_BANK_IDX(ADT7420_TEMPERATURE_LOW_MSB)] = adc_code >> 8U;
+	bank[ADT7420_CONFIG_BANK_IDX(ADT7420_TEMPERATURE_LOW_LSB)] = adc_code & 0xFFU;
+
+	adc_code = adt7420_temperature_to_adc_code(params->config, params->crit_temperature_c);
+	bank[ADT7420_CONFIG_BANK_IDX(ADT7420_TEMPERATURE_CRIT_MSB)] = adc_code >> 8U;
+	bank[ADT7420_CONFIG_BANK_IDX(ADT7420_TEMPERATURE_CRIT_LSB)] = adc_code & 0xFFU;
+
+	// Hysteresis is a single register holding whole degrees in its lower nibble
+	bank[ADT7420_CONFIG_BANK_IDX(ADT7420_HYSTERESIS)] = params->hysteresis & ADT7420_HYSTERESIS_MASK;
 }
 
-static inline void i2c_stop(I2C_TypeDef* i2c_ch)
+// Shadow matches the sensor straight after a reset, so there's nothing to sync
+static void adt7420_load_defaults(adt7420_dev* dev)
 {
-	LL_I2C_GenerateStopCondition(i2c_ch);
-	while(!LL_I2C_IsActiveFlag_STOP(i2c_ch));
+	dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)] = ADT7420_DEFAULT_CONFIG;
+	dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_TEMPERATURE_HIGH_MSB)] = ADT7420_DEFAULT_HIGH >> 8U;
+	dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_TEMPERATURE_HIGH_LSB)] = ADT7420_DEFAULT_HIGH & 0xFFU;
+	dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_TEMPERATURE_LOW_MSB)] = ADT7420_DEFAULT_LOW >> 8U;
+	dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_TEMPERATURE_LOW_LSB)] = ADT7420_DEFAULT_LOW & 0xFFU;
+	dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_TEMPERATURE_CRIT_MSB)] = ADT7420_DEFAULT_CRIT >> 8U;
+	dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_TEMPERATURE_CRIT_LSB)] = ADT7420_DEFAULT_CRIT & 0xFFU;
+	dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_HYSTERESIS)] = ADT7420_DEFAULT_HYSTERESIS;
+	dev->dirty = 0;
+	dev->synced_config = ADT7420_DEFAULT_CONFIG;
+	dev->decoder = adt7420_select_decoder(ADT7420_DEFAULT_CONFIG);
 }
 
-static inline void i2c_write_bytes(I2C_TypeDef* i2c_ch, uint8_t* tx_buf, uint8_t n_bytes)
+static inline void adt7420_shadow_write(adt7420_dev* dev, uint8_t reg, uint8_t data)
 {
-	for (uint8_t i = 0; i < n_bytes; ++i) {
-		LL_I2C_TransmitData8(i2c_ch, tx_buf[i]);
-		while (!LL_I2C_IsActiveFlag_TXE(i2c_ch));
+	uint8_t idx = ADT7420_CONFIG_BANK_IDX(reg);
+	// Writing back what the sensor already holds costs nothing
+	if (dev->shadow[idx] != data) {
+		dev->shadow[idx] = data;
+		dev->dirty |= 1U << idx;
 	}
 }
 
-static inline void i2c_read_bytes(I2C_TypeDef* i2c_ch, uint8_t* rx_buf, uint8_t n_bytes)
+static inline void adt7420_shadow_write_two(adt7420_dev* dev, uint8_t reg, uint16_t data)
 {
-	for (uint8_t i = 0; i < n_bytes; ++i) {
-		while (!LL_I2C_IsActiveFlag_RXNE(i2c_ch));
-		rx_buf[i] = LL_I2C_ReceiveData8(i2c_ch);
-	}
+	adt7420_shadow_write(dev, reg, data >> 8U);
+	adt7420_shadow_write(dev, reg + 1U, data & 0xFFU);
 }
 
-Adt7420_status adt7420_write_one_reg(adt7420_dev* dev, uint8_t reg, uint8_t data)
+static Adt7420_status adt7420_read_c(adt7420_dev* dev, uint8_t reg, const adt7420_decoder* decoder, float* temperature_c)
 {
-	// Make sure the bus is free, before attemping to transmit
-	if (LL_I2C_IsActiveFlag_BUSY(dev->i2c_ch)) {
-		return ADT7420_I2C_ERROR;
+	uint16_t adc_code;
+	Adt7420_status status = adt7420_read_two_reg(dev, reg, &adc_code);
+	if (status != ADT7420_OK) {
+		return status;
 	}
-	uint8_t tx_buf[2] = {reg, data};
+	*temperature_c = decoder->to_celsius(adc_code);
+	return ADT7420_OK;
+}
 
-	i2c_start_write(dev->i2c_ch, dev->i2c_addr, 2);
-	i2c_write_bytes(dev->i2c_ch, tx_buf, 2);
-	i2c_stop(dev->i2c_ch);
+static Adt7420_status adt7420_read_mdeg(adt7420_dev* dev, uint8_t reg, const adt7420_decoder* decoder, int32_t* temperature_mdeg)
+{
+	uint16_t adc_code;
+	Adt7420_status status = adt7420_read_two_reg(dev, reg, &adc_code);
+	if (status != ADT7420_OK) {
+		return status;
+	}
+	*temperature_mdeg = decoder->to_mdeg(adc_code);
+	return ADT7420_OK;
+}
 
+static Adt7420_status adt7420_set_threshold_mdeg(adt7420_dev* dev, uint8_t reg, int32_t temperature_mdeg)
+{
+	if (!adt7420_is_valid_mdeg(temperature_mdeg)) {
+		return ADT7420_INVALID_SETTING;
+	}
+	adt7420_shadow_write_two(dev, reg, adt7420_mdeg_to_adc_code(temperature_mdeg));
 	return ADT7420_OK;
 }
 
-Adt7420_status adt7420_read_one_reg(adt7420_dev* dev, uint8_t reg, uint8_t* data)
+// The peripheral ends every transfer itself, software end is only used to hold the bus for a repeated start
+static inline void i2c_start_write(I2C_TypeDef* i2c_ch, uint8_t addr, uint8_t n_bytes, bool read_follows)
 {
-	if (LL_I2C_IsActiveFlag_BUSY(dev->i2c_ch)) {
-		return ADT7420_I2C_ERROR;
+	uint32_t end_mode = read_follows ? LL_I2C_MODE_SOFTEND : LL_I2C_MODE_AUTOEND;
+	LL_I2C_HandleTransfer(i2c_ch, addr << 1U, LL_I2C_ADDRSLAVE_7BIT, n_bytes, end_mode, LL_I2C_GENERATE_START_WRITE);
+}
+
+static inline void i2c_start_read(I2C_TypeDef* i2c_ch, uint8_t addr, uint8_t n_bytes, bool restart)
+{
+	uint32_t request = restart ? LL_I2C_GENERATE_RESTART_7BIT_READ : LL_I2C_GENERATE_START_READ;
+	LL_I2C_HandleTransfer(i2c_ch, addr << 1U, LL_I2C_ADDRSLAVE_7BIT, n_bytes, LL_I2C_MODE_AUTOEND, request);
+}
+
+// Every wait gives up on a NACK, a bus fault or the deadline, so a missing sensor or stuck line can't hang the caller
+static I2c_status i2c_wait(I2C_TypeDef* i2c_ch, uint32_t flag, uint32_t start)
+{
+	while (!(READ_REG(i2c_ch->ISR) & flag)) {
+		if (LL_I2C_IsActiveFlag_NACK(i2c_ch)) {
+			LL_I2C_ClearFlag_NACK(i2c_ch);
+			return I2C_NACK;
+		}
+		I2c_status status = i2c_bus_take_errors(i2c_ch);
+		if (status != I2C_OK) {
+			return status;
+		}
+		if (dwt_timer_elapsed(start) > dwt_timer_us_to_cycles(ADT7420_I2C_TIMEOUT_US)) {
+			return I2C_TIMEOUT;
+		}
 	}
+	return I2C_OK;
+}
 
-	i2c_start_write(dev->i2c_ch, dev->i2c_addr, 1);
-	i2c_write_bytes(dev->i2c_ch, &reg, 1);
-	i2c_start_read(dev->i2c_ch, dev->i2c_addr, 1);
-	i2c_read_bytes(dev->i2c_ch, data, 1);
-	i2c_stop(dev->i2c_ch);
+static I2c_status i2c_transfer(I2C_TypeDef* i2c_ch, uint8_t addr, uint8_t* tx_buf, uint8_t tx_len, uint8_t* rx_buf, uint8_t rx_len)
+{
+	I2c_status status = I2C_OK;
+	uint32_t start = dwt_timer_cycles();
 
-	return ADT7420_OK;
+	if (LL_I2C_IsActiveFlag_BUSY(i2c_ch)) {
+		return I2C_BUSY;
+	}
+
+	if (tx_len) {
+		i2c_start_write(i2c_ch, addr, tx_len, rx_len != 0);
+		for (uint8_t i = 0; i < tx_len && status == I2C_OK; ++i) {
+			status = i2c_wait(i2c_ch, I2C_ISR_TXIS, start);
+			if (status == I2C_OK) {
+				LL_I2C_TransmitData8(i2c_ch, tx_buf[i]);
+			}
+		}
+		// Register pointer is fully out before the repeated start
+		if (status == I2C_OK && rx_len) {
+			status = i2c_wait(i2c_ch, I2C_ISR_TC, start);
+		}
+	}
+
+	if (status == I2C_OK && rx_len) {
+		i2c_start_read(i2c_ch, addr, rx_len, tx_len != 0);
+		for (uint8_t i = 0; i < rx_len && status == I2C_OK; ++i) {
+			status = i2c_wait(i2c_ch, I2C_ISR_RXNE, start);
+			if (status == I2C_OK) {
+				rx_buf[i] = LL_I2C_ReceiveData8(i2c_ch);
+			}
+		}
+	}
+
+	// AUTOEND, or the hardware itself after a NACK, sends the STOP, it just needs acknowledging
+	if (status == I2C_OK || status == I2C_NACK) {
+		I2c_status stop_status = i2c_wait(i2c_ch, I2C_ISR_STOPF, start);
+		if (stop_status == I2C_OK) {
+			LL_I2C_ClearFlag_STOP(i2c_ch);
+			LL_I2C_ClearFlag_TXE(i2c_ch);
+		}
+		status = status == I2C_OK ? stop_status : status;
+	}
+	return status;
 }
 
-Adt7420_status adt7420_write_two_reg(adt7420_dev* dev, uint8_t reg, uint16_t data)
+static Adt7420_status adt7420_i2c_status(I2c_status status)
 {
-	if (LL_I2C_IsActiveFlag_BUSY(dev->i2c_ch)) {
+	switch (status) {
+	case I2C_OK:
+		return ADT7420_OK;
+	case I2C_PENDING:
+	case I2C_BUSY:
+		return ADT7420_BUSY;
+	case I2C_NACK:
+		return ADT7420_I2C_NACK;
+	case I2C_TIMEOUT:
+		return ADT7420_I2C_TIMEOUT;
+	case I2C_ARB_LOST:
+		return ADT7420_I2C_ARB_LOST;
+	default:
 		return ADT7420_I2C_ERROR;
 	}
+}
+
+// Polled transfers have no bus to do the bookkeeping, so they're timed & counted here
+static Adt7420_status adt7420_poll(adt7420_dev* dev, uint8_t* tx_buf, uint8_t tx_len, uint8_t* rx_buf, uint8_t rx_len)
+{
+	uint32_t start = dwt_timer_cycles();
+	I2c_status status = i2c_transfer(dev->i2c_ch, dev->i2c_addr, tx_buf, tx_len, rx_buf, rx_len);
+
+	// A fault or timeout leaves the peripheral mid transfer & maybe a slave holding SDA, the same recovery as the
+	// bus puts both back to idle. Lost arbitration isn't stuck, the other master still owns the bus
+	if (status == I2C_BUS_ERROR || status == I2C_TIMEOUT) {
+		if (dev->recovery != NULL) {
+			i2c_bus_recover(dev->recovery);
+		} else {
+			LL_I2C_Disable(dev->i2c_ch);
+			dwt_timer_delay_us(1);
+			LL_I2C_Enable(dev->i2c_ch);
+		}
+	}
+	if (status != I2C_BUSY) {
+		i2c_stats_record(&dev->stats, status, dwt_timer_elapsed(start));
+	}
+	return adt7420_i2c_status(status);
+}
+
+Adt7420_status adt7420_write_one_reg(adt7420_dev* dev, uint8_t reg, uint8_t data)
+{
+	if (dev->bus != NULL) {
+		return adt7420_bus_write(dev, reg, &data, 1);
+	}
+	uint8_t tx_buf[2] = {reg, data};
+	return adt7420_poll(dev, tx_buf, 2, NULL, 0);
+}
+
+Adt7420_status adt7420_read_one_reg(adt7420_dev* dev, uint8_t reg, uint8_t* data)
+{
+	if (dev->bus != NULL) {
+		return adt7420_bus_read(dev, reg, data, 1);
+	}
+	return adt7420_poll(dev, &reg, 1, data, 1);
+}
+
+Adt7420_status adt7420_write_two_reg(adt7420_dev* dev, uint8_t reg, uint16_t data)
+{
 	// Send the MSB of the uint16_t first after register address
 	uint8_t tx_buf[3] = {reg, (data >> 8U), data & 0xFF};
+	if (dev->bus != NULL) {
+		return adt7420_bus_write(dev, reg, &tx_buf[1], 2);
+	}
+	return adt7420_poll(dev, tx_buf, 3, NULL, 0);
+}
 
-	i2c_start_write(dev->i2c_ch, dev->i2c_addr, 3);
-	i2c_write_bytes(dev->i2c_ch, tx_buf, 3);
-	i2c_stop(dev->i2c_ch);
+Adt7420_status adt7420_read_two_reg(adt7420_dev* dev, uint8_t reg, uint16_t* data)
+{
+	uint8_t rx_buf[2];
+	Adt7420_status status;
+
+	if (dev->bus != NULL) {
+		status = adt7420_bus_read(dev, reg, rx_buf, 2);
+	} else {
+		status = adt7420_poll(dev, &reg, 1, rx_buf, 2);
+	}
+	if (status != ADT7420_OK) {
+		return status;
+	}
 
+	*data = (rx_buf[0] << 8U) | (rx_buf[1] & 0xFFU);
 	return ADT7420_OK;
 }
 
-Adt7420_status adt7420_read_two_reg(adt7420_dev* dev, uint8_t reg, uint16_t* data)
+Adt7420_status adt7420_read_burst(adt7420_dev* dev, uint8_t reg, uint8_t* data, uint8_t n_bytes)
 {
-	if (LL_I2C_IsActiveFlag_BUSY(dev->i2c_ch)) {
-		return ADT7420_I2C_ERROR;
+	if (n_bytes == 0 || n_bytes > ADT7420_NUM_REGS) {
+		return ADT7420_INVALID_SETTING;
+	}
+	if (dev->bus != NULL) {
+		return adt7420_bus_read(dev, reg, data, n_bytes);
 	}
 
-	uint8_t rx_buf[2];
-	
-	i2c_start_write(dev->i2c_ch, dev->i2c_addr, 1);
-	i2c_write_bytes(dev->i2c_ch, &reg, 1);
+	// Register pointer auto-increments, so consecutive registers come back in one read
+	return adt7420_poll(dev, &reg, 1, data, n_bytes);
+}
 
-	i2c_start_read(dev->i2c_ch, dev->i2c_addr, 2);
-	i2c_read_bytes(dev->i2c_ch, rx_buf, 2);
+Adt7420_status adt7420_write_burst(adt7420_dev* dev, uint8_t reg, uint8_t* data, uint8_t n_bytes)
+{
+	if (n_bytes == 0 || n_bytes > ADT7420_NUM_REGS) {
+		return ADT7420_INVALID_SETTING;
+	}
+	if (dev->bus != NULL) {
+		return adt7420_bus_write(dev, reg, data, n_bytes);
+	}
 
-	i2c_stop(dev->i2c_ch);
+	// Register pointer followed by the data in a single transfer
+	uint8_t tx_buf[ADT7420_XFER_BUF_SIZE];
+	tx_buf[0] = reg;
+	memcpy(&tx_buf[1], data, n_bytes);
+	return adt7420_poll(dev, tx_buf, n_bytes + 1U, NULL, 0);
+}
 
-	*data = (rx_buf[0] << 8U) | (rx_buf[1] & 0xFFU);
+static void adt7420_prepare(adt7420_dev* dev, uint8_t tx_len, uint8_t rx_len, I2c_priority priority)
+{
+	dev->xfer.addr = dev->i2c_addr;
+	dev->xfer.tx_buf = dev->tx_buf;
+	dev->xfer.tx_len = tx_len;
+	dev->xfer.rx_buf = dev->rx_buf;
+	dev->xfer.rx_len = rx_len;
+	dev->xfer.callback = NULL;
+	dev->xfer.ctx = dev;
+	dev->xfer.next = NULL;
+	dev->xfer.priority = priority;
+	dev->xfer.stats = &dev->stats;
+}
+
+static Adt7420_status adt7420_submit(adt7420_dev* dev, uint8_t tx_len, uint8_t rx_len, I2c_priority priority)
+{
+	if (dev->bus == NULL || i2c_xfer_pending(&dev->xfer)) {
+		return ADT7420_BUSY;
+	}
+
+	adt7420_prepare(dev, tx_len, rx_len, priority);
+	if (i2c_bus_submit(dev->bus, &dev->xfer) != I2C_OK) {
+		return ADT7420_BUSY;
+	}
+	return ADT7420_OK;
+}
+
+static Adt7420_status adt7420_xfer_status(adt7420_dev* dev)
+{
+	return adt7420_i2c_status(dev->xfer.status);
+}
+
+static inline I2c_priority adt7420_read_priority(uint8_t reg)
+{
+	// Status decides whether an alarm is still active, so it jumps the routine reads
+	return reg == ADT7420_STATUS ? I2C_PRIORITY_ALARM : I2C_PRIORITY_SAMPLE;
+}
+
+// Blocking calls on a device with a bus queue behind the scheduler like everyone else, then wait,
+// so they mustn't be made from an ISR at or above the I2C interrupt priority
+static Adt7420_status adt7420_bus_read(adt7420_dev* dev, uint8_t reg, uint8_t* data, uint8_t n_bytes)
+{
+	Adt7420_status status = adt7420_submit_read_burst(dev, reg, n_bytes);
+	if (status != ADT7420_OK) {
+		return status;
+	}
+	while (i2c_xfer_pending(&dev->xfer)) {
+		i2c_bus_check_timeout(dev->bus);
+	}
+	return adt7420_complete_read_burst(dev, data, n_bytes);
+}
+
+static Adt7420_status adt7420_bus_write(adt7420_dev* dev, uint8_t reg, uint8_t* data, uint8_t n_bytes)
+{
+	Adt7420_status status = adt7420_submit_write_burst(dev, reg, data, n_bytes);
+	if (status != ADT7420_OK) {
+		return status;
+	}
+	while (i2c_xfer_pending(&dev->xfer)) {
+		i2c_bus_check_timeout(dev->bus);
+	}
+	return adt7420_xfer_status(dev);
+}
+
+Adt7420_status adt7420_submit_read_two_reg(adt7420_dev* dev, uint8_t reg)
+{
+	// Don't touch the buffers of a transfer the ISR is still working on
+	if (i2c_xfer_pending(&dev->xfer)) {
+		return ADT7420_BUSY;
+	}
+	dev->tx_buf[0] = reg;
+	return adt7420_submit(dev, 1, 2, adt7420_read_priority(reg));
+}
+
+Adt7420_status adt7420_submit_write_two_reg(adt7420_dev* dev, uint8_t reg, uint16_t data)
+{
+	if (i2c_xfer_pending(&dev->xfer)) {
+		return ADT7420_BUSY;
+	}
+	dev->tx_buf[0] = reg;
+	dev->tx_buf[1] = data >> 8U;
+	dev->tx_buf[2] = data & 0xFFU;
+	return adt7420_submit(dev, 3, 0, I2C_PRIORITY_CONFIG);
+}
+
+bool adt7420_xfer_complete(adt7420_dev* dev)
+{
+	return !i2c_xfer_pending(&dev->xfer);
+}
+
+Adt7420_status adt7420_complete_read_two_reg(adt7420_dev* dev, uint16_t* data)
+{
+	Adt7420_status status = adt7420_xfer_status(dev);
+	if (status != ADT7420_OK) {
+		return status;
+	}
+	*data = (dev->rx_buf[0] << 8U) | (dev->rx_buf[1] & 0xFFU);
 	return ADT7420_OK;
 }
 
+Adt7420_status adt7420_complete_write_two_reg(adt7420_dev* dev)
+{
+	return adt7420_xfer_status(dev);
+}
+
+Adt7420_status adt7420_submit_read_burst(adt7420_dev* dev, uint8_t reg, uint8_t n_bytes)
+{
+	if (n_bytes == 0 || n_bytes > ADT7420_NUM_REGS) {
+		return ADT7420_INVALID_SETTING;
+	}
+	if (i2c_xfer_pending(&dev->xfer)) {
+		return ADT7420_BUSY;
+	}
+	dev->tx_buf[0] = reg;
+	return adt7420_submit(dev, 1, n_bytes, adt7420_read_priority(reg));
+}
+
+Adt7420_status adt7420_submit_write_burst(adt7420_dev* dev, uint8_t reg, uint8_t* data, uint8_t n_bytes)
+{
+	if (n_bytes == 0 || n_bytes > ADT7420_NUM_REGS) {
+		return ADT7420_INVALID_SETTING;
+	}
+	if (i2c_xfer_pending(&dev->xfer)) {
+		return ADT7420_BUSY;
+	}
+	dev->tx_buf[0] = reg;
+	memcpy(&dev->tx_buf[1], data, n_bytes);
+	return adt7420_submit(dev, n_bytes + 1U, 0, I2C_PRIORITY_CONFIG);
+}
+
+Adt7420_status adt7420_complete_read_burst(adt7420_dev* dev, uint8_t* data, uint8_t n_bytes)
+{
+	Adt7420_status status = adt7420_xfer_status(dev);
+	if (status != ADT7420_OK) {
+		return status;
+	}
+	memcpy(data, dev->rx_buf, n_bytes < dev->xfer.rx_len ? n_bytes : dev->xfer.rx_len);
+	return ADT7420_OK;
+}
 
 Adt7420_status adt7420_init(adt7420_dev* dev, adt7420_settings* params)
 {
@@ -190,130 +591,282 @@ Adt7420_status adt7420_init(adt7420_dev* dev, adt7420_settings* params)
 		return ADT7420_INVALID_SETTING;
 	}
 
+	i2c_stats_reset(&dev->stats);
+
+	// Whole register image is computed up front, so the bus only sees the ID read & one burst
+	adt7420_build_config_bank(params, dev->shadow);
+	dev->dirty = (1U << ADT7420_CONFIG_BANK_SIZE) - 1U;
+
 	uint8_t chip_id;
-	if (adt7420_read_one_reg(dev, ADT7420_ID, &chip_id) != ADT7420_OK || chip_id != ADT7420_CHIP_ID) {
-		return ADT7420_I2C_ERROR;
+	Adt7420_status status = adt7420_read_one_reg(dev, ADT7420_ID, &chip_id);
+	if (status != ADT7420_OK) {
+		return status;
+	}
+	if (chip_id != ADT7420_CHIP_ID) {
+		return ADT7420_INVALID_ADDR;
 	}
 
+	return adt7420_sync(dev);
+}
+
+Adt7420_status adt7420_warm_init(adt7420_dev* dev, adt7420_settings* params)
+{
+	uint8_t bank[ADT7420_CONFIG_BANK_SIZE + 1U];
 
+	if (!adt7420_parse_params(params)) {
+		return ADT7420_INVALID_SETTING;
+	}
+
+	i2c_stats_reset(&dev->stats);
+	adt7420_build_config_bank(params, dev->shadow);
+	dev->dirty = 0;
+
+	// ID sits straight after hysteresis, so the check & the whole bank are one read
+	Adt7420_status status = adt7420_read_burst(dev, ADT7420_CONFIG, bank, sizeof(bank));
+	if (status != ADT7420_OK) {
+		return status;
+	}
+	if (bank[ADT7420_CONFIG_BANK_IDX(ADT7420_ID)] != ADT7420_CHIP_ID) {
+		return ADT7420_INVALID_ADDR;
+	}
+	dev->synced_config = bank[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)];
+
+	for (uint8_t i = 0; i < ADT7420_CONFIG_BANK_SIZE; ++i) {
+		if (bank[i] != dev->shadow[i]) {
+			dev->dirty |= 1U << i;
+		}
+	}
+	// Sync returns early when nothing differs, so the decoder can't be left to it
+	dev->decoder = adt7420_select_decoder(dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)]);
+	return adt7420_sync(dev);
+}
+
+Adt7420_status adt7420_reset(adt7420_dev* dev)
+{
+	uint8_t cmd = ADT7420_RESET;
 	Adt7420_status status;
-	status = adt7420_write_one_reg(dev, ADT7420_CONFIG, params->config);
 
-	uint16_t temperature_c;
-	temperature_c = adt7420_temperature_to_adc_code(params->config, params->crit_temperature_c);
-	status = adt7420_write_two_reg(dev, ADT7420_TEMPERATURE_CRIT_MSB, temperature_c);
+	// Reset is a bare command byte, no register pointer or data after it
+	if (dev->bus != NULL) {
+		if (i2c_xfer_pending(&dev->xfer)) {
+			return ADT7420_BUSY;
+		}
+		dev->tx_buf[0] = cmd;
+		status = adt7420_submit(dev, 1, 0, I2C_PRIORITY_CONFIG);
+		if (status != ADT7420_OK) {
+			return status;
+		}
+		while (i2c_xfer_pending(&dev->xfer)) {
+			i2c_bus_check_timeout(dev->bus);
+		}
+		status = adt7420_xfer_status(dev);
+	} else {
+		status = adt7420_poll(dev, &cmd, 1, NULL, 0);
+	}
+	if (status != ADT7420_OK) {
+		return status;
+	}
+
+	dwt_timer_delay_us(ADT7420_RESET_US);
+	adt7420_load_defaults(dev);
+	return ADT7420_OK;
+}
 
-	temperature_c = adt7420_temperature_to_adc_code(params->config, params->high_temperature_c);
-	status = adt7420_write_two_reg(dev, ADT7420_TEMPERATURE_HIGH_MSB, temperature_c);
+Adt7420_status adt7420_dump_registers(adt7420_dev* dev, adt7420_reg_map* map)
+{
+	// Temperature, status & thresholds all come from the same transaction, so they agree with each other
+	return adt7420_read_burst(dev, ADT7420_TEMPERATURE_MSB, (uint8_t*)map, sizeof(*map));
+}
 
-	temperature_c = adt7420_temperature_to_adc_code(params->config, params->low_temperature_c);
-	status = adt7420_write_two_reg(dev, ADT7420_TEMPERATURE_LOW_MSB, temperature_c);
+Adt7420_status adt7420_restore_registers(adt7420_dev* dev, const adt7420_reg_map* map)
+{
+	uint8_t bank[ADT7420_CONFIG_BANK_SIZE];
 
-	temperature_c = adt7420_temperature_to_adc_code(params->config, params->hysteresis);
-	status = adt7420_write_two_reg(dev, ADT7420_HYSTERESIS, temperature_c);
+	// Temperature, status & ID are read only, the writable registers are contiguous from config
+	memcpy(bank, &map->config, ADT7420_CONFIG_BANK_SIZE);
+	bank[ADT7420_CONFIG_BANK_IDX(ADT7420_HYSTERESIS)] &= ADT7420_HYSTERESIS_MASK;
 
-	return status;
+	Adt7420_status status = adt7420_write_burst(dev, ADT7420_CONFIG, bank, ADT7420_CONFIG_BANK_SIZE);
+	if (status != ADT7420_OK) {
+		return status;
+	}
+	memcpy(dev->shadow, bank, ADT7420_CONFIG_BANK_SIZE);
+	dev->dirty = 0;
+	dev->synced_config = dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)];
+	dev->decoder = adt7420_select_decoder(dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)]);
+	return ADT7420_OK;
 }
 
 Adt7420_status adt7420_on(adt7420_dev* dev)
 {
-	uint8_t config;
-	if (adt7420_get_config(dev, &config) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
-	}
 	// Will set ADT7420 To continuous operation.
-	config &= ~ADT7420_SHUTDOWN_MODE;
-	if (adt7420_set_config(dev, config) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
-	}
+	uint8_t config = dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)] & ~ADT7420_SHUTDOWN_MODE;
+	adt7420_shadow_write(dev, ADT7420_CONFIG, config);
 	return ADT7420_OK;
 }
 
 Adt7420_status adt7420_shutdown(adt7420_dev* dev)
 {
-	uint8_t config;
-	if (adt7420_get_config(dev, &config) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+	uint8_t config = dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)] | ADT7420_SHUTDOWN_MODE;
+	adt7420_shadow_write(dev, ADT7420_CONFIG, config);
+	return ADT7420_OK;
+}
+
+Adt7420_status adt7420_sync(adt7420_dev* dev)
+{
+	if (!dev->dirty) {
+		return ADT7420_OK;
 	}
 
-	config |= ADT7420_SHUTDOWN_MODE;
-	if (adt7420_set_config(dev, config) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+	// One burst from the first to the last dirty register, rewriting any clean ones in between
+	// is cheaper than paying for another start, address & register pointer
+	uint8_t first = 0;
+	uint8_t last = ADT7420_CONFIG_BANK_SIZE - 1U;
+	while (!(dev->dirty & (1U << first))) {
+		++first;
 	}
-	return ADT7420_OK;
+	while (!(dev->dirty & (1U << last))) {
+		--last;
+	}
+
+	Adt7420_status status = adt7420_write_burst(dev, ADT7420_CONFIG + first, &dev->shadow[first], last - first + 1U);
+	if (status == ADT7420_OK) {
+		dev->dirty = 0;
+		dev->synced_config = dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)];
+		// Shadow now matches the sensor, so its resolution decides how samples are decoded
+		dev->decoder = adt7420_select_decoder(dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)]);
+	}
+	return status;
+}
+
+bool adt7420_is_dirty(adt7420_dev* dev)
+{
+	return dev->dirty != 0;
 }
 
 Adt7420_status adt7420_get_status(adt7420_dev* dev, uint8_t* status)
 {
-	if (adt7420_read_one_reg(dev, ADT7420_STATUS, status) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
-	}
-	return ADT7420_OK;
+	return adt7420_read_one_reg(dev, ADT7420_STATUS, status);
 }
 
 Adt7420_status adt7420_get_config(adt7420_dev* dev, uint8_t* config)
 {
-	if (adt7420_read_one_reg(dev, ADT7420_CONFIG, config) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+	Adt7420_status status = adt7420_read_one_reg(dev, ADT7420_CONFIG, config);
+	if (status != ADT7420_OK) {
+		return status;
 	}
+	dev->synced_config = *config;
+	dev->decoder = adt7420_select_decoder(*config);
 	return ADT7420_OK;
 }
 
 Adt7420_status adt7420_get_temperature(adt7420_dev* dev, float* temperature_c)
+{
+	return adt7420_read_c(dev, ADT7420_TEMPERATURE_MSB, adt7420_temperature_decoder(dev), temperature_c);
+}
+
+Adt7420_status adt7420_get_temperature_mdeg(adt7420_dev* dev, int32_t* temperature_mdeg)
+{
+	return adt7420_read_mdeg(dev, ADT7420_TEMPERATURE_MSB, adt7420_temperature_decoder(dev), temperature_mdeg);
+}
+
+Adt7420_status adt7420_submit_get_temperature(adt7420_dev* dev)
+{
+	return adt7420_submit_read_two_reg(dev, ADT7420_TEMPERATURE_MSB);
+}
+
+Adt7420_status adt7420_complete_get_temperature(adt7420_dev* dev, float* temperature_c)
 {
 	uint16_t adc_code;
-	if (adt7420_read_two_reg(dev, ADT7420_TEMPERATURE_MSB, &adc_code) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+	Adt7420_status status = adt7420_complete_read_two_reg(dev, &adc_code);
+	if (status != ADT7420_OK) {
+		return status;
 	}
-	*temperature_c = adt7420_adc_code_to_temperature(adc_code);
+	*temperature_c = adt7420_temperature_decoder(dev)->to_celsius(adc_code);
 	return ADT7420_OK;
 }
 
-Adt7420_status adt7420_get_low_temperature_c(adt7420_dev* dev, float* temperature_c)
+Adt7420_status adt7420_get_sample(adt7420_dev* dev, adt7420_sample* sample)
 {
-	uint16_t adc_code;
-	if (adt7420_read_two_reg(dev, ADT7420_TEMPERATURE_LOW_MSB, &adc_code) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+	uint8_t raw[ADT7420_SAMPLE_SIZE];
+	Adt7420_status status = adt7420_read_burst(dev, ADT7420_TEMPERATURE_MSB, raw, ADT7420_SAMPLE_SIZE);
+	if (status != ADT7420_OK) {
+		return status;
 	}
-	*temperature_c = adt7420_adc_code_to_temperature(adc_code);
+	adt7420_decode_sample(adt7420_temperature_decoder(dev), raw, sample);
 	return ADT7420_OK;
 }
 
-Adt7420_status adt7420_get_high_temperature_c(adt7420_dev* dev, float* temperature_c)
-{	
-	uint16_t adc_code;
-	if (adt7420_read_two_reg(dev, ADT7420_TEMPERATURE_HIGH_MSB, &adc_code) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+Adt7420_status adt7420_submit_get_sample(adt7420_dev* dev)
+{
+	return adt7420_submit_read_burst(dev, ADT7420_TEMPERATURE_MSB, ADT7420_SAMPLE_SIZE);
+}
+
+i2c_xfer* adt7420_prepare_get_sample(adt7420_dev* dev)
+{
+	if (i2c_xfer_pending(&dev->xfer)) {
+		return NULL;
 	}
-	*temperature_c = adt7420_adc_code_to_temperature(adc_code);
-	return ADT7420_OK;
+	dev->tx_buf[0] = ADT7420_TEMPERATURE_MSB;
+	adt7420_prepare(dev, 1, ADT7420_SAMPLE_SIZE, I2C_PRIORITY_SAMPLE);
+	return &dev->xfer;
 }
 
-Adt7420_status adt7420_get_crit_temperature_c(adt7420_dev* dev, float* temperature_c)
+Adt7420_status adt7420_complete_get_sample(adt7420_dev* dev, adt7420_sample* sample)
 {
-	uint16_t adc_code;
-	if (adt7420_read_two_reg(dev, ADT7420_TEMPERATURE_CRIT_MSB, &adc_code) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+	Adt7420_status status = adt7420_xfer_status(dev);
+	if (status != ADT7420_OK) {
+		return status;
 	}
-	*temperature_c = adt7420_adc_code_to_temperature(adc_code);
+	adt7420_decode_sample(adt7420_temperature_decoder(dev), dev->rx_buf, sample);
 	return ADT7420_OK;
 }
 
+Adt7420_status adt7420_get_low_temperature_c(adt7420_dev* dev, float* temperature_c)
+{
+	return adt7420_read_c(dev, ADT7420_TEMPERATURE_LOW_MSB, &adt7420_decoder_16_bit, temperature_c);
+}
+
+Adt7420_status adt7420_get_high_temperature_c(adt7420_dev* dev, float* temperature_c)
+{
+	return adt7420_read_c(dev, ADT7420_TEMPERATURE_HIGH_MSB, &adt7420_decoder_16_bit, temperature_c);
+}
+
+Adt7420_status adt7420_get_crit_temperature_c(adt7420_dev* dev, float* temperature_c)
+{
+	return adt7420_read_c(dev, ADT7420_TEMPERATURE_CRIT_MSB, &adt7420_decoder_16_bit, temperature_c);
+}
+
 Adt7420_status adt7420_get_hysteresis(adt7420_dev* dev, float* hysteresis_c)
 {
-	uint16_t adc_code;
-	if (adt7420_read_two_reg(dev, ADT7420_HYSTERESIS, &adc_code) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+	uint8_t hysteresis;
+	Adt7420_status status = adt7420_read_one_reg(dev, ADT7420_HYSTERESIS, &hysteresis);
+	if (status != ADT7420_OK) {
+		return status;
 	}
-	*hysteresis_c = adt7420_adc_code_to_temperature(adc_code);
+	*hysteresis_c = hysteresis & ADT7420_HYSTERESIS_MASK;
 	return ADT7420_OK;
 }
 
+Adt7420_status adt7420_get_low_temperature_mdeg(adt7420_dev* dev, int32_t* temperature_mdeg)
+{
+	// Threshold registers are always in 16 bit format, whatever the conversion resolution
+	return adt7420_read_mdeg(dev, ADT7420_TEMPERATURE_LOW_MSB, &adt7420_decoder_16_bit, temperature_mdeg);
+}
+
+Adt7420_status adt7420_get_high_temperature_mdeg(adt7420_dev* dev, int32_t* temperature_mdeg)
+{
+	return adt7420_read_mdeg(dev, ADT7420_TEMPERATURE_HIGH_MSB, &adt7420_decoder_16_bit, temperature_mdeg);
+}
+
+Adt7420_status adt7420_get_crit_temperature_mdeg(adt7420_dev* dev, int32_t* temperature_mdeg)
+{
+	return adt7420_read_mdeg(dev, ADT7420_TEMPERATURE_CRIT_MSB, &adt7420_decoder_16_bit, temperature_mdeg);
+}
+
 Adt7420_status adt7420_set_config(adt7420_dev* dev, uint8_t config)
 {
-	if (adt7420_write_one_reg(dev, ADT7420_CONFIG, config)) {
-		return ADT7420_I2C_ERROR;
-	}
+	adt7420_shadow_write(dev, ADT7420_CONFIG, config);
 	return ADT7420_OK;
 }
 
@@ -322,16 +875,9 @@ Adt7420_status adt7420_set_low_temperature_c(adt7420_dev* dev, int16_t temperatu
 	if (!adt7420_is_valid_temperature(temperature_c, false)) {
 		return ADT7420_INVALID_SETTING;
 	}
-	
-	uint8_t config;
-	if (adt7420_get_config(dev, &config) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
-	}
 
-	uint16_t adc_code = adt7420_temperature_to_adc_code(config, temperature_c);
-	if (adt7420_write_two_reg(dev, ADT7420_TEMPERATURE_LOW_MSB, adc_code) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
-	}
+	uint8_t config = dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)];
+	adt7420_shadow_write_two(dev, ADT7420_TEMPERATURE_LOW_MSB, adt7420_temperature_to_adc_code(config, temperature_c));
 	return ADT7420_OK;
 }
 
@@ -341,50 +887,218 @@ Adt7420_status adt7420_set_high_temperature_c(adt7420_dev* dev, int16_t temperat
 		return ADT7420_INVALID_SETTING;
 	}
 
-	uint8_t config;
-	if (adt7420_get_config(dev, &config) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+	uint8_t config = dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)];
+	adt7420_shadow_write_two(dev, ADT7420_TEMPERATURE_HIGH_MSB, adt7420_temperature_to_adc_code(config, temperature_c));
+	return ADT7420_OK;
+}
+
+Adt7420_status adt7420_set_crit_temperature_c(adt7420_dev* dev, int16_t temperature_c)
+{
+	if (!adt7420_is_valid_temperature(temperature_c, false)) {
+		return ADT7420_INVALID_SETTING;
 	}
 
-	uint16_t adc_code = adt7420_temperature_to_adc_code(config, temperature_c);
-	if (adt7420_write_two_reg(dev, ADT7420_TEMPERATURE_HIGH_MSB, adc_code) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+	uint8_t config = dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)];
+	adt7420_shadow_write_two(dev, ADT7420_TEMPERATURE_CRIT_MSB, adt7420_temperature_to_adc_code(config, temperature_c));
+	return ADT7420_OK;
+}
+
+Adt7420_status adt7420_set_hysteresis(adt7420_dev* dev, int16_t hysteresis_c)
+{
+	if (!adt7420_is_valid_temperature(hysteresis_c, true)) {
+		return ADT7420_INVALID_SETTING;
 	}
+
+	adt7420_shadow_write(dev, ADT7420_HYSTERESIS, hysteresis_c & ADT7420_HYSTERESIS_MASK);
 	return ADT7420_OK;
 }
 
-Adt7420_status adt7420_set_crit_temperature_c(adt7420_dev* dev, int16_t temperature_c)
+Adt7420_status adt7420_set_low_temperature_mdeg(adt7420_dev* dev, int32_t temperature_mdeg)
 {
-	if (!adt7420_is_valid_temperature(temperature_c, false)) {
+	return adt7420_set_threshold_mdeg(dev, ADT7420_TEMPERATURE_LOW_MSB, temperature_mdeg);
+}
+
+Adt7420_status adt7420_set_high_temperature_mdeg(adt7420_dev* dev, int32_t temperature_mdeg)
+{
+	return adt7420_set_threshold_mdeg(dev, ADT7420_TEMPERATURE_HIGH_MSB, temperature_mdeg);
+}
+
+Adt7420_status adt7420_set_crit_temperature_mdeg(adt7420_dev* dev, int32_t temperature_mdeg)
+{
+	return adt7420_set_threshold_mdeg(dev, ADT7420_TEMPERATURE_CRIT_MSB, temperature_mdeg);
+}
+
+bool adt7420_int_asserted(adt7420_dev* dev)
+{
+	// INT & CT share a port, polarity comes from the config last synced to the sensor, not a pending change
+	bool active_high = (dev->synced_config & ADT7420_INT_ACTIVE_HIGH) != 0;
+	return (LL_GPIO_IsInputPinSet(dev->int_port, dev->int_pin) != 0) == active_high;
+}
+
+bool adt7420_ct_asserted(adt7420_dev* dev)
+{
+	bool active_high = (dev->synced_config & ADT7420_CT_ACTIVE_HIGH) != 0;
+	return (LL_GPIO_IsInputPinSet(dev->int_port, dev->ct_pin) != 0) == active_high;
+}
+
+Adt7420_status adt7420_track_enable(adt7420_dev* dev, int32_t delta_mdeg)
+{
+	if (delta_mdeg <= 0 || delta_mdeg > ADT7420_MAX_TEMPERATURE_MDEG - ADT7420_MIN_TEMPERATURE_MDEG) {
 		return ADT7420_INVALID_SETTING;
 	}
 
-	uint8_t config;
-	if (adt7420_get_config(dev, &config) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+	// Interrupt mode, so INT fires once per window crossing & is cleared by the status read
+	uint8_t config = dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)] & ~ADT7420_COMP_MODE;
+	adt7420_shadow_write(dev, ADT7420_CONFIG, config | ADT7420_INT_MODE);
+	// INT only re-arms once the temperature is back past the old limit by T_HYST, with any hysteresis at all a
+	// steady drift through the re-centred window would never fire again
+	adt7420_shadow_write(dev, ADT7420_HYSTERESIS, 0);
+
+	adt7420_sample sample;
+	Adt7420_status status = adt7420_get_sample(dev, &sample);
+	if (status != ADT7420_OK) {
+		return status;
 	}
 
-	uint16_t adc_code = adt7420_temperature_to_adc_code(config, temperature_c);
-	if (adt7420_write_two_reg(dev, ADT7420_TEMPERATURE_CRIT_MSB, adc_code) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+	dev->track_delta_mdeg = delta_mdeg;
+	// Force a re-centre around the current reading
+	dev->track_center_mdeg = sample.temperature_mdeg + (2 * delta_mdeg);
+	return adt7420_track_update(dev, sample.temperature_mdeg);
+}
+
+Adt7420_status adt7420_track_update(adt7420_dev* dev, int32_t temperature_mdeg)
+{
+	if (dev->track_delta_mdeg == 0) {
+		return ADT7420_OK;
 	}
+
+	int32_t moved = temperature_mdeg - dev->track_center_mdeg;
+	if (moved < 0) {
+		moved = -moved;
+	}
+	// Still inside the window, nothing on the sensor needs to change
+	if (moved < dev->track_delta_mdeg) {
+		return ADT7420_OK;
+	}
+
+	adt7420_set_high_temperature_mdeg(dev, adt7420_clamp_mdeg(temperature_mdeg + dev->track_delta_mdeg));
+	adt7420_set_low_temperature_mdeg(dev, adt7420_clamp_mdeg(temperature_mdeg - dev->track_delta_mdeg));
+	// T_HIGH & T_LOW are adjacent, so the new window goes out as one burst
+	Adt7420_status status = adt7420_sync(dev);
+	// Until the sensor has the new window the old centre stands, so the next sample tries again
+	if (status == ADT7420_OK) {
+		dev->track_center_mdeg = temperature_mdeg;
+	}
+	return status;
+}
+
+void adt7420_track_disable(adt7420_dev* dev)
+{
+	dev->track_delta_mdeg = 0;
+}
+
+Adt7420_status adt7420_set_operation_mode(adt7420_dev* dev, uint8_t mode)
+{
+	if (mode & ~ADT7420_OP_MODE_MASK) {
+		return ADT7420_INVALID_SETTING;
+	}
+	uint8_t config = dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)] & ~ADT7420_OP_MODE_MASK;
+	adt7420_shadow_write(dev, ADT7420_CONFIG, config | mode);
 	return ADT7420_OK;
 }
 
-Adt7420_status adt7420_set_hysteresis(adt7420_dev* dev, int16_t hysteresis_c)
+Adt7420_status adt7420_trigger_one_shot(adt7420_dev* dev)
 {
-	if (!adt7420_is_valid_temperature(hysteresis_c, true)) {
+	adt7420_set_operation_mode(dev, ADT7420_ONE_SHOT_MODE);
+	// Sensor falls back to shutdown by itself, so the write has to go out even if the shadow already matches
+	dev->dirty |= 1U << ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG);
+	return adt7420_sync(dev);
+}
+
+i2c_xfer* adt7420_prepare_trigger_one_shot(adt7420_dev* dev)
+{
+	if (i2c_xfer_pending(&dev->xfer)) {
+		return NULL;
+	}
+	adt7420_set_operation_mode(dev, ADT7420_ONE_SHOT_MODE);
+	dev->tx_buf[0] = ADT7420_CONFIG;
+	dev->tx_buf[1] = dev->shadow[ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG)];
+	adt7420_prepare(dev, 2, 0, I2C_PRIORITY_CONFIG);
+	return &dev->xfer;
+}
+
+Adt7420_status adt7420_complete_trigger_one_shot(adt7420_dev* dev)
+{
+	Adt7420_status status = adt7420_xfer_status(dev);
+	if (status == ADT7420_OK) {
+		// Config went out with the write, anything else still dirty waits for the next sync
+		dev->dirty &= ~(1U << ADT7420_CONFIG_BANK_IDX(ADT7420_CONFIG));
+		dev->synced_config = dev->tx_buf[1];
+	}
+	return status;
+}
+
+Adt7420_status adt7420_sampler_init(adt7420_sampler* sampler, adt7420_dev* dev, uint8_t mode, uint32_t period_ms)
+{
+	if (mode == ADT7420_ONE_SHOT_MODE) {
+		if (period_ms <= ADT7420_ONE_SHOT_CONVERSION_MS) {
+			return ADT7420_INVALID_SETTING;
+		}
+		// Nothing to convert until the first trigger
+		adt7420_set_operation_mode(dev, ADT7420_SHUTDOWN_MODE);
+	} else if (mode == ADT7420_SPS_MODE) {
+		// A new result is only ready once a second, reading any faster just returns the old one
+		if (period_ms < ADT7420_SPS_PERIOD_MS) {
+			return ADT7420_INVALID_SETTING;
+		}
+		adt7420_set_operation_mode(dev, ADT7420_SPS_MODE);
+	} else {
 		return ADT7420_INVALID_SETTING;
 	}
 
-	uint8_t config;
-	if (adt7420_get_config(dev, &config) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+	sampler->dev = dev;
+	sampler->mode = mode;
+	sampler->period_ms = period_ms;
+	sampler->state = ADT7420_SAMPLER_IDLE;
+	return adt7420_sync(dev);
+}
+
+Adt7420_status adt7420_sampler_step(adt7420_sampler* sampler, adt7420_sample* sample, uint32_t* next_ms)
+{
+	Adt7420_status status;
+
+	// SPS mode converts on its own, so every step is just a read
+	if (sampler->mode == ADT7420_SPS_MODE) {
+		*next_ms = sampler->period_ms;
+		return adt7420_get_sample(sampler->dev, sample);
 	}
 
-	uint16_t adc_code = adt7420_temperature_to_adc_code(config, hysteresis_c);
-	if (adt7420_write_one_reg(dev, ADT7420_HYSTERESIS, adc_code) != ADT7420_OK) {
-		return ADT7420_I2C_ERROR;
+	if (sampler->state == ADT7420_SAMPLER_IDLE) {
+		status = adt7420_trigger_one_shot(sampler->dev);
+		if (status != ADT7420_OK) {
+			*next_ms = sampler->period_ms;
+			return status;
+		}
+		// Caller sleeps through the conversion, there's no sample to hand back yet
+		sampler->state = ADT7420_SAMPLER_CONVERTING;
+		*next_ms = ADT7420_ONE_SHOT_CONVERSION_MS;
+		return ADT7420_BUSY;
 	}
-	return ADT7420_OK;
+
+	sampler->state = ADT7420_SAMPLER_IDLE;
+	*next_ms = sampler->period_ms - ADT7420_ONE_SHOT_CONVERSION_MS;
+	return adt7420_get_sample(sampler->dev, sample);
+}
+
+void adt7420_get_stats(adt7420_dev* dev, i2c_stats* stats)
+{
+	i2c_stats_snapshot(&dev->stats, stats);
+}
+
+void adt7420_reset_stats(adt7420_dev* dev)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	i2c_stats_reset(&dev->stats);
+	__set_PRIMASK(primask);
 }
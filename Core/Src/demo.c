@@ -10,37 +10,87 @@
 
 ring_buffer usart_tx_buf; // TODO may need to make volatile, or underlying struct members?
 volatile bool timer2_overflow_flag = false;
+volatile bool adt7420_alarm_flag = false;
+i2c_bus i2c1_bus;
+hd44780u display;
 
-static adt7420_dev dev;
-static hd44780u display;
-static char str_buf[16];
-static char lcd_buf[16];
+static adt7420_array sensors;
+#if ADT7420_LOW_POWER_SAMPLING
+static bool converting; // Group trigger is out, next tick gathers the results
+#endif
+static uint8_t stats_source; // Bus, then each sensor in turn, one per reading
+static char str_buf[64];
+static char lcd_buf[17];
 
 void hd44780u_config(void)
 {
 	display.port = GPIOB;
 	display.en_pin = LL_GPIO_PIN_4;
 	display.rs_pin = LL_GPIO_PIN_5;
+	display.rw_pin = 0; // R/W tied to ground, set to the pin wired to it for busy flag polling
 	display.d4_pin = LL_GPIO_PIN_0;
 	display.d5_pin = LL_GPIO_PIN_7;
 	display.d6_pin = LL_GPIO_PIN_6;
 	display.d7_pin = LL_GPIO_PIN_1;
 	hd44780u_init(&display);
 	hd44780u_display_on(&display, HD44780U_CURSOR_OFF | HD44780U_BLINK_OFF);
+	// From here on writes return straight away, timer 6 sends them out at the controller's pace
+	hd44780u_attach_timer(&display, TIM6);
 }
 
 void adt7420_config(void)
 {
 	adt7420_settings params;
-	params.config = ADT7420_16_BIT_RES | ADT7420_COMP_MODE | ADT7420_FAULT_QUEUE_1 | ADT7420_INT_ACTIVE_HIGH | ADT7420_CT_ACTIVE_HIGH | ADT7420_CONTINUOUS_MODE;
+	// INT & CT of every sensor share a pair of open drain lines, so they're active low, a sensor that isn't
+	// alarming just leaves the line to the pull up & the first one pulling it low gives EXTI a falling edge
+	params.config = ADT7420_16_BIT_RES | ADT7420_INT_MODE | ADT7420_FAULT_QUEUE_1 | ADT7420_INT_ACTIVE_LOW | ADT7420_CT_ACTIVE_LOW | ADT7420_CONTINUOUS_MODE;
 	params.crit_temperature_c = 30;
 	params.high_temperature_c = 27;
 	params.low_temperature_c = 18;
 	params.hysteresis = 2;
 
-	dev.i2c_addr = 0x4B; // Jumper 1 & 2 Open
-	dev.i2c_ch = I2C1;
-	adt7420_init(&dev, &params);
+	// Bus goes to the I2C ISR first, so probing an address with no sensor fitted just NACKs
+	i2c_bus_init(&i2c1_bus, I2C1);
+	// I2C1 TX & RX are DMA1 channel 6 & 7 on request 3, so data bytes don't cost any CPU time
+	LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+	i2c_bus_enable_dma(&i2c1_bus, DMA1, LL_DMA_CHANNEL_6, LL_DMA_CHANNEL_7, LL_DMA_REQUEST_3);
+	i2c_bus_set_timeout(&i2c1_bus, I2C_BUS_TIMEOUT_US);
+	i2c_bus_set_deadline_timer(&i2c1_bus, TIM7);
+	// Replaces the fixed 400kHz TIMINGR from MX_I2C1_Init (CubeMX assumed no rise or fall time) with one computed
+	// for the running clock
+	i2c_bus_set_speed(&i2c1_bus, I2C_BUS_SPEED);
+	i2c_bus_set_recovery_pins(&i2c1_bus, ADT7420_SCL_GPIO_Port, ADT7420_SCL_Pin, ADT7420_SDA_Pin);
+
+	// Whichever of 0x48 - 0x4B have a sensor fitted, so jumper changes need no reflash
+	if (adt7420_array_init(&sensors, &i2c1_bus, &params) != ADT7420_OK) {
+		usart_log_temperature("No ADT7420 found\n\r");
+		return;
+	}
+	for (uint8_t ch = 0; ch < ADT7420_ARRAY_MAX_SENSORS; ++ch) {
+		if (adt7420_array_is_present(&sensors, ch)) {
+			snprintf(str_buf, sizeof(str_buf), "ADT7420 at 0x%02X\n\r", (unsigned)sensors.sensors[ch].i2c_addr);
+			usart_log_temperature(str_buf);
+		}
+	}
+	adt7420_array_set_budget_us(&sensors, ADT7420_SWEEP_BUDGET_US);
+
+	for (uint8_t ch = 0; ch < ADT7420_ARRAY_MAX_SENSORS; ++ch) {
+		if (!adt7420_array_is_present(&sensors, ch)) {
+			continue;
+		}
+		adt7420_dev* dev = &sensors.sensors[ch];
+		// INT & CT are open drain & active low, every sensor is wired onto the same two pins
+		dev->int_port = ADT7420_INT_GPIO_Port;
+		dev->int_pin = ADT7420_INT_Pin;
+		dev->ct_pin = ADT7420_CT_Pin;
+#if ADT7420_LOW_POWER_SAMPLING
+		// Nothing to convert until the first group trigger
+		adt7420_set_operation_mode(dev, ADT7420_SHUTDOWN_MODE);
+		adt7420_sync(dev);
+#else
+		adt7420_track_enable(dev, ADT7420_TRACK_DELTA_MDEG);
+#endif
+	}
 }
 
 void usart_log_temperature(char *str)
@@ -57,20 +107,156 @@ void usart_log_temperature(char *str)
 	LL_USART_EnableIT_TXE(USART2);
 }
 
-void read_adt7420(void)
+static void format_mdeg(char* buf, size_t len, int32_t temperature_mdeg)
+{
+	// Hundredths of a degree, printed without any float conversion
+	const char* sign = temperature_mdeg < 0 ? "-" : "";
+	int32_t magnitude = temperature_mdeg < 0 ? -temperature_mdeg : temperature_mdeg;
+	snprintf(buf, len, "%s%ld.%02ld", sign, (long)(magnitude / 1000), (long)((magnitude % 1000) / 10));
+}
+
+static void log_i2c_stats(const char* name, i2c_stats* stats)
 {
-	float temperature;
-	adt7420_get_temperature(&dev, &temperature);
-	sprintf(str_buf, "Temp: %dC\n\r", (int)temperature);
-	sprintf(lcd_buf, "Temp: %dC", (int)temperature);
+	// n transfers, nack/timeout/arbitration/bus errors, retries, min/avg/max transaction cycles
+	snprintf(str_buf, sizeof(str_buf), "%s n%lu e%lu/%lu/%lu/%lu r%lu c%lu/%lu/%lu\n\r", name,
+		(unsigned long)stats->transfers, (unsigned long)stats->nacks, (unsigned long)stats->timeouts,
+		(unsigned long)stats->arb_losts, (unsigned long)stats->bus_errors, (unsigned long)stats->retries,
+		(unsigned long)(stats->transfers ? stats->min_cycles : 0), (unsigned long)i2c_stats_avg_cycles(stats),
+		(unsigned long)stats->max_cycles);
 	usart_log_temperature(str_buf);
-	hd44780u_display_clear(&display);
-	hd44780u_put_str(&display, lcd_buf, strlen(lcd_buf));
+}
+
+static void log_next_i2c_stats(void)
+{
+	i2c_stats stats;
+	char name[8];
+
+	// Whole dump would overflow the USART buffer, so one line goes out with each reading
+	if (stats_source == 0) {
+		i2c_bus_get_stats(&i2c1_bus, &stats);
+		log_i2c_stats("I2C1", &stats);
+	} else {
+		uint8_t ch = stats_source - 1U;
+		if (adt7420_array_is_present(&sensors, ch)) {
+			adt7420_get_stats(&sensors.sensors[ch], &stats);
+			snprintf(name, sizeof(name), "0x%02X", (unsigned)sensors.sensors[ch].i2c_addr);
+			log_i2c_stats(name, &stats);
+		}
+	}
+	stats_source = (stats_source + 1U) % (ADT7420_ARRAY_MAX_SENSORS + 1U);
+}
+
+static void sleep_until_swept(adt7420_array* array)
+{
+	// Interrupts are masked around the check so a completion can't slip in between it & WFI,
+	// a pending interrupt still wakes the core from WFI with PRIMASK set
+	__disable_irq();
+	while (!adt7420_array_sweep_done(array)) {
+		// Woken by the I2C interrupts, or by the timer 7 deadline if the bus has hung. Either may leave a bus
+		// recovery pending for this call to run
+		i2c_bus_check_timeout(array->bus);
+		SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+		__WFI();
+		__enable_irq();
+		__disable_irq();
+	}
+	__enable_irq();
+}
+
+#if ADT7420_LOW_POWER_SAMPLING
+// ARR preload is off & TIM2 is 32 bits, so a counter already past the new ARR would run on for ~49 days
+static void restart_sample_timer(uint32_t period_ms)
+{
+	LL_TIM_SetCounter(TIM2, 0);
+	LL_TIM_SetAutoReload(TIM2, period_ms - 1U);
+}
+#endif
+
+void read_adt7420(bool timer_tick)
+{
+	adt7420_array_record record;
+	char temperature[8];
+
+	// Logged ahead of the reading, so the counters still go out while the sensors are failing
+	log_next_i2c_stats();
+#if ADT7420_LOW_POWER_SAMPLING
+	// Timer 2 ticks at 1kHz, sleep until the conversion is done or the next one is due. Only its ticks move the
+	// trigger/gather cycle on, an alarm in between just reads back whatever the sensors last converted
+	if (timer_tick && !converting) {
+		// Every sensor's one shot goes out in one transaction, so the readings are taken within microseconds
+		if (adt7420_array_start_trigger(&sensors) != ADT7420_OK) {
+			return;
+		}
+		sleep_until_swept(&sensors);
+		if (adt7420_array_complete_trigger(&sensors, NULL) == ADT7420_OK) {
+			converting = true;
+			restart_sample_timer(ADT7420_ONE_SHOT_CONVERSION_MS);
+		}
+		return;
+	}
+	if (timer_tick) {
+		converting = false;
+		restart_sample_timer(ADT7420_SAMPLE_PERIOD_MS - ADT7420_ONE_SHOT_CONVERSION_MS);
+	}
+	if (adt7420_array_start_sweep(&sensors) != ADT7420_OK) {
+		return;
+	}
+	sleep_until_swept(&sensors);
+	if (adt7420_array_complete_sweep(&sensors, &record) != ADT7420_OK) {
+		return;
+	}
+	snprintf(str_buf, sizeof(str_buf), "Skew: %luus\n\r", (unsigned long)dwt_timer_cycles_to_us(record.trigger_skew_cycles));
+	usart_log_temperature(str_buf);
+#else
+	(void)timer_tick; // Continuous conversion, a tick & an alarm both just read the latest result
+	// Temperature & alarm status of every sensor in one chained transaction
+	if (adt7420_array_start_sweep(&sensors) != ADT7420_OK) {
+		return;
+	}
+	sleep_until_swept(&sensors);
+	if (adt7420_array_complete_sweep(&sensors, &record) != ADT7420_OK) {
+		return;
+	}
+
+	// Move each T_HIGH/T_LOW window along with its reading, so INT stays quiet while stable
+	for (uint8_t ch = 0; ch < ADT7420_ARRAY_MAX_SENSORS; ++ch) {
+		if ((record.valid >> ch) & 1U) {
+			adt7420_track_update(&sensors.sensors[ch], record.samples[ch].temperature_mdeg);
+		}
+	}
+	snprintf(str_buf, sizeof(str_buf), "Sweep: %luus%s\n\r", (unsigned long)dwt_timer_cycles_to_us(record.sweep_cycles),
+		record.over_budget ? "!" : "");
+	usart_log_temperature(str_buf);
+#endif
+
+	bool shown = false;
+	for (uint8_t ch = 0; ch < ADT7420_ARRAY_MAX_SENSORS; ++ch) {
+		if (!((record.valid >> ch) & 1U)) {
+			continue;
+		}
+		adt7420_sample* sample = &record.samples[ch];
+		format_mdeg(temperature, sizeof(temperature), sample->temperature_mdeg);
+		// Flag which limit, if any, tripped the reading
+		const char* alarm = sample->t_crit ? "!" : sample->t_high ? "+" : sample->t_low ? "-" : "";
+		snprintf(str_buf, sizeof(str_buf), "Temp%u: %sC%s\n\r", (unsigned)ch, temperature, alarm);
+		usart_log_temperature(str_buf);
+
+		// LCD only has room for the lowest channel
+		if (!shown) {
+			snprintf(lcd_buf, sizeof(lcd_buf), "Temp: %sC", temperature);
+			// Only the digits that changed since the last reading are sent, no clear & no flicker
+			hd44780u_fb_put_line(&display, 0, lcd_buf);
+			hd44780u_fb_commit(&display);
+			shown = true;
+		}
+	}
 }
 
 void sys_init(void)
 {
 	ring_buffer_init(&usart_tx_buf);
+	// LCD timings, bus timeouts & recovery are all timed off the cycle counter
+	dwt_timer_init();
 	hd44780u_config();
 	adt7420_config();
 }
@@ -6,82 +6,253 @@
  */
 
 #include "hd44780u_driver.h"
+#include "string.h"
 
-static inline void hd44780u_pulse_en(hd44780u* display);
+static void hd44780u_build_nibble_table(hd44780u* display);
+static inline void hd44780u_clock_nibble(hd44780u* display, uint8_t nibble);
+static inline uint32_t hd44780u_exec_us(uint8_t command);
+static void hd44780u_set_data_mode(hd44780u* display, uint32_t mode);
+static inline uint8_t hd44780u_read_nibble(hd44780u* display);
+static void hd44780u_wait_ready(hd44780u* display);
+static void hd44780u_send(hd44780u* display, uint8_t byte, bool data);
+static void hd44780u_enqueue(hd44780u* display, uint16_t entry);
 
-static inline void hd44780u_pulse_en(hd44780u* display)
+// Every data pin's set or reset bit for each nibble value, so a nibble is one BSRR store whatever the pin mapping
+static void hd44780u_build_nibble_table(hd44780u* display)
 {
+	const uint32_t pins[4] = {display->d4_pin, display->d5_pin, display->d6_pin, display->d7_pin};
+
+	for (uint8_t nibble = 0; nibble < HD44780U_NIBBLE_VALUES; ++nibble) {
+		uint32_t bsrr = 0;
+		for (uint8_t bit = 0; bit < 4U; ++bit) {
+			// Upper half of BSRR resets the pin
+			bsrr |= (nibble & (1U << bit)) ? pins[bit] : pins[bit] << 16U;
+		}
+		display->nibble_bsrr[nibble] = bsrr;
+	}
+}
+
+static inline void hd44780u_clock_nibble(hd44780u* display, uint8_t nibble)
+{
+	// Data only has to be set up before EN falls, so it goes out in the same store that raises EN
+	display->port->BSRR = display->nibble_bsrr[nibble & 0xFU] | display->en_pin;
+	dwt_timer_delay_cycles(dwt_timer_ns_to_cycles(HD44780U_EN_PULSE_NS));
+	display->port->BRR = display->en_pin;
+	// Rest of the enable cycle also covers the data hold time after the falling edge
+	dwt_timer_delay_cycles(dwt_timer_ns_to_cycles(HD44780U_EN_CYCLE_NS - HD44780U_EN_PULSE_NS));
+}
+
+static inline uint32_t hd44780u_exec_us(uint8_t command)
+{
+	// Clear & return home (0x02 or 0x03) rewrite the whole DDRAM, everything else is ~37us
+	if (command == HD44780U_DISPLAY_CLEAR || (command & ~0x1U) == HD44780U_RETURN_HOME) {
+		return HD44780U_CLEAR_HOME_US;
+	}
+	return HD44780U_EXEC_US;
+}
+
+static void hd44780u_set_data_mode(hd44780u* display, uint32_t mode)
+{
+	LL_GPIO_SetPinMode(display->port, display->d4_pin, mode);
+	LL_GPIO_SetPinMode(display->port, display->d5_pin, mode);
+	LL_GPIO_SetPinMode(display->port, display->d6_pin, mode);
+	LL_GPIO_SetPinMode(display->port, display->d7_pin, mode);
+}
+
+static inline uint8_t hd44780u_read_nibble(hd44780u* display)
+{
+	uint8_t nibble = 0;
+
+	// Controller drives the data pins while EN is high, sampled once they're valid & EN held for the rest of the pulse
 	display->port->BSRR = display->en_pin;
-	LL_mDelay(1);
+	dwt_timer_delay_cycles(dwt_timer_ns_to_cycles(HD44780U_DATA_DELAY_NS));
+	uint32_t idr = display->port->IDR;
+	dwt_timer_delay_cycles(dwt_timer_ns_to_cycles(HD44780U_EN_PULSE_NS - HD44780U_DATA_DELAY_NS));
 	display->port->BRR = display->en_pin;
+	dwt_timer_delay_cycles(dwt_timer_ns_to_cycles(HD44780U_EN_CYCLE_NS - HD44780U_EN_PULSE_NS));
+
+	if (idr & display->d4_pin) {
+		nibble |= 0x1U;
+	}
+	if (idr & display->d5_pin) {
+		nibble |= 0x2U;
+	}
+	if (idr & display->d6_pin) {
+		nibble |= 0x4U;
+	}
+	if (idr & display->d7_pin) {
+		nibble |= 0x8U;
+	}
+	return nibble;
+}
+
+// With R/W fitted the controller is asked before each write, so nothing waits longer than it has to
+static void hd44780u_wait_ready(hd44780u* display)
+{
+	if (!display->rw_pin) {
+		return;
+	}
+	uint32_t start = dwt_timer_cycles();
+	uint32_t timeout = dwt_timer_us_to_cycles(HD44780U_BUSY_TIMEOUT_US);
+	// A controller that never clears BF (or isn't there) mustn't hang the caller, worst case is a lost character
+	while ((hd44780u_read_status(display) & HD44780U_BUSY_FLAG) && dwt_timer_elapsed(start) < timeout);
 }
 
 void hd44780u_init(hd44780u* display)
 {
 	// 8 Bit-mode function set instructions
-	LL_mDelay(100); // Todo: See if delay can be reduced without issue
-	hd44780u_write_nibble(display, 0x3U);
-	LL_mDelay(4);
-	hd44780u_write_nibble(display, 0x3U);
-	LL_mDelay(1);
-	hd44780u_write_nibble(display, 0x3U);
-	LL_mDelay(1);
-	hd44780u_write_nibble(display, 0x2U);
-	LL_mDelay(1);
-
-	// DISPLAY NOW IN 4-BIT MODE
-	hd44780u_write_command(display, 0x2U); // Real function set: 2 Lines & 5x8 font
-	hd44780u_write_command(display, HD44780U_DISPLAY_CTRL | HD44780U_DISPLAY_OFF);
-	LL_mDelay(1);
+	hd44780u_build_nibble_table(display);
+	display->port->BRR = display->rw_pin; // Writes only until the controller is in 4-bit mode
+	LL_mDelay(HD44780U_POWER_ON_MS); // Todo: See if delay can be reduced without issue
+	hd44780u_clock_nibble(display, 0x3U);
+	dwt_timer_delay_us(HD44780U_INIT_FIRST_US);
+	hd44780u_clock_nibble(display, 0x3U);
+	dwt_timer_delay_us(HD44780U_INIT_SECOND_US);
+	hd44780u_clock_nibble(display, 0x3U);
+	dwt_timer_delay_us(HD44780U_EXEC_US);
+	hd44780u_clock_nibble(display, 0x2U);
+	dwt_timer_delay_us(HD44780U_EXEC_US);
 
+	// DISPLAY NOW IN 4-BIT MODE, busy flag can be read from here on, otherwise every command waits out its own execution time
+	hd44780u_write_command(display, HD47780U_FUNCTION_SET | HD44780U_4_BIT_INTERFACE | HD44780U_2_DISPLAY_LINES
+		| HD44780U_5x8_CHAR_FONT); // Real function set: 2 Lines & 5x8 font
+	hd44780u_write_command(display, HD44780U_DISPLAY_CTRL | HD44780U_DISPLAY_OFF);
 	hd44780u_write_command(display, HD44780U_DISPLAY_CLEAR);
-	LL_mDelay(3);
+	memset(display->frame, ' ', sizeof(display->frame));
+	memset(display->shown, ' ', sizeof(display->shown));
 	// Set address counter to increment after ddram write
 	hd44780u_write_command(display, HD44780U_ENTRY_MODE_SET | HD44780U_ENTRY_MODE_INC);
-	LL_mDelay(1);
 }
 
 
 void hd44780u_write_nibble(hd44780u* display, uint8_t nibble)
 {
-	if (nibble & 0x1U) {
-		display->port->BSRR = display->d4_pin;
-	} else {
-		display->port->BRR = display->d4_pin;
-	}
-	if (nibble & 0x2U) {
-		display->port->BSRR = display->d5_pin;
-	} else {
-		display->port->BRR = display->d5_pin;
+	display->port->BSRR = display->nibble_bsrr[nibble & 0xFU];
+}
+
+uint8_t hd44780u_read_status(hd44780u* display)
+{
+	if (!display->rw_pin) {
+		return 0;
 	}
-	if (nibble & 0x4U) {
-		display->port->BSRR = display->d6_pin;
-	} else {
-		display->port->BRR = display->d6_pin;
+
+	hd44780u_set_data_mode(display, LL_GPIO_MODE_INPUT);
+	display->port->BRR = display->rs_pin;
+	display->port->BSRR = display->rw_pin;
+	dwt_timer_delay_cycles(dwt_timer_ns_to_cycles(HD44780U_ADDR_SETUP_NS));
+
+	// BF & address counter bits 6-4 come first, then address counter bits 3-0
+	uint8_t status = hd44780u_read_nibble(display) << 4U;
+	status |= hd44780u_read_nibble(display);
+
+	display->port->BRR = display->rw_pin;
+	hd44780u_set_data_mode(display, LL_GPIO_MODE_OUTPUT);
+	return status;
+}
+
+Hd44780u_status hd44780u_get_address(hd44780u* display, uint8_t* addr)
+{
+	if (!display->rw_pin) {
+		return HD44780U_NO_RW_PIN;
 	}
-	if (nibble & 0x8U) {
-		display->port->BSRR = display->d7_pin;
+	// Pins belong to the ISR until the queue has drained
+	while (display->tim != NULL && !hd44780u_queue_empty(display));
+	hd44780u_wait_ready(display);
+	// Address counter is only updated a few us after BF clears
+	dwt_timer_delay_us(HD44780U_ADDR_UPDATE_US);
+	*addr = hd44780u_read_status(display) & HD44780U_ADDR_MASK;
+	return HD44780U_OK;
+}
+
+static void hd44780u_send(hd44780u* display, uint8_t byte, bool data)
+{
+	if (data) {
+		display->port->BSRR = display->rs_pin;
 	} else {
-		display->port->BRR = display->d7_pin;
+		display->port->BRR = display->rs_pin; // RS pin low to select instruction register
 	}
+	// RS has to settle before EN rises
+	dwt_timer_delay_cycles(dwt_timer_ns_to_cycles(HD44780U_ADDR_SETUP_NS));
+	hd44780u_clock_nibble(display, byte >> 4U); // Shift upper nibble to lower bits for first write
+	hd44780u_clock_nibble(display, byte & 0xFU); // Now we only care about the lower nibble
+}
+
+static void hd44780u_enqueue(hd44780u* display, uint16_t entry)
+{
+	uint8_t next = (display->queue_head + 1U) % HD44780U_QUEUE_SIZE;
+
+	// Only full while the ISR is still working through a redraw, so waiting here loses nothing
+	while (next == display->queue_tail);
+	display->queue[display->queue_head] = entry;
+	display->queue_head = next;
+	// (Re)Enable the update interrupt so the queue will be emptied by the ISR in the background,
+	// it fires straight away if the last write has already had its execution time
+	LL_TIM_EnableIT_UPDATE(display->tim);
 }
 
 void hd44780u_write_command(hd44780u* display, uint8_t command)
 {
-	display->port->BRR = display->rs_pin; // RS pin low to select instruction register
-	hd44780u_write_nibble(display, command >> 4U); // Shift upper nibble to lower bits for first write
-	hd44780u_pulse_en(display);
-	hd44780u_write_nibble(display, command & 0xFU); // Now we only care about the lower nibble
-	hd44780u_pulse_en(display);
+	if (display->tim != NULL) {
+		hd44780u_enqueue(display, command);
+		return;
+	}
+	hd44780u_wait_ready(display);
+	hd44780u_send(display, command, false);
+	if (!display->rw_pin) {
+		dwt_timer_delay_us(hd44780u_exec_us(command));
+	}
 }
 
 void hd44780u_write_data(hd44780u* display, uint8_t addr)
 {
-	display->port->BSRR = display->rs_pin;
-	hd44780u_write_nibble(display, addr >> 4U);
-	hd44780u_pulse_en(display);
-	hd44780u_write_nibble(display, addr & 0xFU);
-	hd44780u_pulse_en(display);
+	if (display->tim != NULL) {
+		hd44780u_enqueue(display, HD44780U_QUEUE_DATA | addr);
+		return;
+	}
+	hd44780u_wait_ready(display);
+	hd44780u_send(display, addr, true);
+	if (!display->rw_pin) {
+		dwt_timer_delay_us(HD44780U_EXEC_US);
+	}
+}
+
+void hd44780u_attach_timer(hd44780u* display, TIM_TypeDef* tim)
+{
+	display->queue_head = 0;
+	display->queue_tail = 0;
+	LL_TIM_DisableIT_UPDATE(tim);
+	LL_TIM_SetAutoReload(tim, HD44780U_EXEC_US - 1U);
+	display->tim = tim;
+}
+
+bool hd44780u_queue_empty(hd44780u* display)
+{
+	return display->queue_head == display->queue_tail;
+}
+
+void hd44780u_timer_irq_handler(hd44780u* display)
+{
+	if (!LL_TIM_IsActiveFlag_UPDATE(display->tim)) {
+		return;
+	}
+	LL_TIM_ClearFlag_UPDATE(display->tim);
+	if (hd44780u_queue_empty(display)) {
+		LL_TIM_DisableIT_UPDATE(display->tim);
+		return;
+	}
+
+	uint16_t entry = display->queue[display->queue_tail];
+	display->queue_tail = (display->queue_tail + 1U) % HD44780U_QUEUE_SIZE;
+	bool data = entry & HD44780U_QUEUE_DATA;
+	hd44780u_send(display, entry & 0xFFU, data);
+
+	// Next entry goes out once this one has executed, timed from now so a late interrupt can't overshoot ARR
+	LL_TIM_SetCounter(display->tim, 0);
+	LL_TIM_SetAutoReload(display->tim, (data ? HD44780U_EXEC_US : hd44780u_exec_us(entry & 0xFFU)) - 1U);
+	if (hd44780u_queue_empty(display)) {
+		// Update flag still marks the end of this write, enqueue picks it up when it re-enables the interrupt
+		LL_TIM_DisableIT_UPDATE(display->tim);
+	}
 }
 
 Hd44780u_status hd44780u_display_on(hd44780u* display, uint8_t cursor_flags)
@@ -107,6 +278,8 @@ void hd44780u_display_clear(hd44780u* display)
 {
 	display->cursor.row = 0;
 	display->cursor.col = 0;
+	memset(display->frame, ' ', sizeof(display->frame));
+	memset(display->shown, ' ', sizeof(display->shown));
 	hd44780u_write_command(display, HD44780U_DISPLAY_CLEAR);
 }
 
@@ -187,6 +360,9 @@ Hd44780u_status hd44780u_put_char(hd44780u* display, uint8_t c)
 	}
 	
 	hd44780u_write_data(display, c);
+	// Direct writes keep the framebuffer in step, so a later commit doesn't undo them
+	display->frame[display->cursor.row][display->cursor.col] = c;
+	display->shown[display->cursor.row][display->cursor.col] = c;
 	++display->cursor.col;
 	return HD44780U_OK;
 }
@@ -204,3 +380,49 @@ Hd44780u_status hd44780u_put_str(hd44780u* display, char* str, size_t len)
 	}
 	return HD44780U_OK;
 }
+
+Hd44780u_status hd44780u_fb_put_str(hd44780u* display, uint8_t row, uint8_t col, const char* str, size_t len)
+{
+	if (row > HD44780U_MAX_ROW_POS || col + len > HD44780U_NUM_COLS) {
+		return HD44780U_INVALID_DISPLAY_POS;
+	}
+	memcpy(&display->frame[row][col], str, len);
+	return HD44780U_OK;
+}
+
+Hd44780u_status hd44780u_fb_put_line(hd44780u* display, uint8_t row, const char* str)
+{
+	if (row > HD44780U_MAX_ROW_POS) {
+		return HD44780U_INVALID_DISPLAY_POS;
+	}
+	// Rest of the row is blanked, so a shorter line doesn't leave the tail of the last one behind
+	size_t len = strnlen(str, HD44780U_NUM_COLS);
+	memcpy(display->frame[row], str, len);
+	memset(&display->frame[row][len], ' ', HD44780U_NUM_COLS - len);
+	return HD44780U_OK;
+}
+
+void hd44780u_fb_clear(hd44780u* display)
+{
+	// Spaces rather than the clear command, which costs 1.52ms & blanks the display until it's redrawn
+	memset(display->frame, ' ', sizeof(display->frame));
+}
+
+void hd44780u_fb_commit(hd44780u* display)
+{
+	for (uint8_t row = 0; row < HD44780U_NUM_ROWS; ++row) {
+		for (uint8_t col = 0; col < HD44780U_NUM_COLS; ++col) {
+			if (display->frame[row][col] == display->shown[row][col]) {
+				continue;
+			}
+			// Address counter increments after every write, so only a jump needs a set DDRAM address. A single
+			// unchanged cell in between is rewritten instead, it costs the same as the command it saves
+			if (display->cursor.row == row && display->cursor.col + 1U == col) {
+				hd44780u_put_char(display, display->frame[row][col - 1U]);
+			} else if (display->cursor.row != row || display->cursor.col != col) {
+				hd44780u_set_cursor(display, row, col);
+			}
+			hd44780u_put_char(display, display->frame[row][col]);
+		}
+	}
+}
@@ -0,0 +1,886 @@
+/*
+ * i2c_bus.c
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+#include "i2c_bus.h"
+#include "string.h"
+
+// Bus timing limits from the I2C specification, all in ns. Signed, the margins worked out from them can go negative
+typedef struct {
+	uint32_t freq_hz;
+	int32_t t_low_min;
+	int32_t t_high_min;
+	int32_t t_su_dat_min;
+	int32_t t_hd_dat_min;
+	int32_t t_hd_dat_max;
+	int32_t t_r_max;
+	int32_t t_f_max;
+} i2c_bus_timing_spec;
+
+static const i2c_bus_timing_spec i2c_bus_timing_specs[I2C_NUM_SPEEDS] = {
+	[I2C_SPEED_STANDARD] = {100000U, 4700U, 4000U, 250U, 0U, 3450U, 1000U, 300U},
+	[I2C_SPEED_FAST] = {400000U, 1300U, 600U, 100U, 0U, 900U, 300U, 300U},
+	[I2C_SPEED_FAST_PLUS] = {1000000U, 500U, 260U, 50U, 0U, 450U, 120U, 120U}
+};
+
+static inline void i2c_bus_enable_it(i2c_bus* bus);
+static inline void i2c_bus_disable_it(I2C_TypeDef* i2c_ch);
+static inline void i2c_bus_dma_config(DMA_TypeDef* dma, uint32_t ch, uint32_t direction, uint32_t periph_addr, uint32_t request);
+static inline void i2c_bus_dma_start(DMA_TypeDef* dma, uint32_t ch, uint8_t* buf, uint16_t len);
+static inline void i2c_bus_dma_stop(i2c_bus* bus);
+static bool i2c_bus_dma_drain(i2c_bus* bus);
+static inline void i2c_bus_deadline_start(TIM_TypeDef* tim, uint32_t us);
+static void i2c_bus_arm_deadline(i2c_bus* bus);
+static inline void i2c_bus_disarm_deadline(i2c_bus* bus);
+static inline bool i2c_bus_expired(i2c_bus* bus);
+static void i2c_bus_expire(i2c_bus* bus);
+static inline uint32_t i2c_bus_end_mode(i2c_xfer* xfer, I2c_phase phase);
+static void i2c_bus_load(i2c_bus* bus, uint16_t len, uint32_t request);
+static void i2c_bus_start(i2c_bus* bus, bool restart);
+static void i2c_bus_complete(i2c_bus* bus, I2c_status status);
+static inline void i2c_bus_enqueue(i2c_bus* bus, i2c_xfer* xfer);
+static inline i2c_xfer* i2c_bus_dequeue(i2c_bus* bus);
+static inline bool i2c_bus_queue_empty(i2c_bus* bus);
+static void i2c_bus_start_next(i2c_bus* bus);
+static void i2c_bus_abort(i2c_bus* bus, I2c_status status);
+static void i2c_bus_clock_out(i2c_bus* bus);
+static void i2c_bus_reset(I2C_TypeDef* i2c_ch);
+static uint32_t i2c_bus_clock_hz(I2C_TypeDef* i2c_ch);
+static inline int32_t i2c_bus_div_ceil(int32_t num, int32_t den);
+
+static inline void i2c_bus_enable_it(i2c_bus* bus)
+{
+	I2C_TypeDef* i2c_ch = bus->i2c_ch;
+	// With DMA moving the data bytes only the end of segment & error events need the CPU
+	if (bus->dma == NULL) {
+		LL_I2C_EnableIT_TX(i2c_ch);
+		LL_I2C_EnableIT_RX(i2c_ch);
+	}
+	LL_I2C_EnableIT_TC(i2c_ch);
+	LL_I2C_EnableIT_STOP(i2c_ch);
+	LL_I2C_EnableIT_NACK(i2c_ch);
+	LL_I2C_EnableIT_ERR(i2c_ch);
+}
+
+static inline void i2c_bus_disable_it(I2C_TypeDef* i2c_ch)
+{
+	LL_I2C_DisableIT_TX(i2c_ch);
+	LL_I2C_DisableIT_RX(i2c_ch);
+	LL_I2C_DisableIT_TC(i2c_ch);
+	LL_I2C_DisableIT_STOP(i2c_ch);
+	LL_I2C_DisableIT_NACK(i2c_ch);
+	LL_I2C_DisableIT_ERR(i2c_ch);
+}
+
+static inline void i2c_bus_dma_config(DMA_TypeDef* dma, uint32_t ch, uint32_t direction, uint32_t periph_addr, uint32_t request)
+{
+	LL_DMA_DisableChannel(dma, ch);
+	LL_DMA_ConfigTransfer(dma, ch, direction | LL_DMA_PRIORITY_HIGH | LL_DMA_MODE_NORMAL | LL_DMA_PERIPH_NOINCREMENT
+		| LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE);
+	LL_DMA_SetPeriphAddress(dma, ch, periph_addr);
+	LL_DMA_SetPeriphRequest(dma, ch, request);
+}
+
+static inline void i2c_bus_dma_start(DMA_TypeDef* dma, uint32_t ch, uint8_t* buf, uint16_t len)
+{
+	LL_DMA_DisableChannel(dma, ch);
+	LL_DMA_SetMemoryAddress(dma, ch, (uint32_t)buf);
+	LL_DMA_SetDataLength(dma, ch, len);
+	LL_DMA_EnableChannel(dma, ch);
+}
+
+static inline void i2c_bus_dma_stop(i2c_bus* bus)
+{
+	LL_I2C_DisableDMAReq_TX(bus->i2c_ch);
+	LL_I2C_DisableDMAReq_RX(bus->i2c_ch);
+	LL_DMA_DisableChannel(bus->dma, bus->dma_tx_ch);
+	LL_DMA_DisableChannel(bus->dma, bus->dma_rx_ch);
+}
+
+// Waits for DMA to collect the last byte before its channel is re-armed, false if it never did
+static bool i2c_bus_dma_drain(i2c_bus* bus)
+{
+	uint32_t start = dwt_timer_cycles();
+	while (LL_I2C_IsActiveFlag_RXNE(bus->i2c_ch)) {
+		if (dwt_timer_elapsed(start) > dwt_timer_us_to_cycles(I2C_BUS_DMA_DRAIN_US)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// One pulse mode, so the counter stops itself at the update & each arm fires once
+static inline void i2c_bus_deadline_start(TIM_TypeDef* tim, uint32_t us)
+{
+	if (us > I2C_BUS_DEADLINE_MAX_US) {
+		us = I2C_BUS_DEADLINE_MAX_US;
+	}
+	LL_TIM_DisableCounter(tim);
+	LL_TIM_SetCounter(tim, 0);
+	LL_TIM_SetAutoReload(tim, us - 1U);
+	LL_TIM_ClearFlag_UPDATE(tim);
+	LL_TIM_EnableCounter(tim);
+}
+
+// Deadline runs from now, the timer gets an extra tick so the cycle count agrees it's past when it fires
+static void i2c_bus_arm_deadline(i2c_bus* bus)
+{
+	bus->start_cycles = dwt_timer_cycles();
+	if (bus->deadline_tim != NULL && bus->timeout_us) {
+		i2c_bus_deadline_start(bus->deadline_tim, bus->timeout_us + 1U);
+	}
+}
+
+static inline void i2c_bus_disarm_deadline(i2c_bus* bus)
+{
+	if (bus->deadline_tim != NULL) {
+		LL_TIM_DisableCounter(bus->deadline_tim);
+		LL_TIM_ClearFlag_UPDATE(bus->deadline_tim);
+	}
+}
+
+static inline bool i2c_bus_expired(i2c_bus* bus)
+{
+	return bus->timeout_cycles && (bus->active != NULL || !i2c_bus_queue_empty(bus))
+		&& dwt_timer_elapsed(bus->start_cycles) > bus->timeout_cycles;
+}
+
+// Fails whatever ran out of time, nothing here waits so it's safe from an ISR. The recovery is left pending
+static void i2c_bus_expire(i2c_bus* bus)
+{
+	i2c_bus_disable_it(bus->i2c_ch);
+	if (bus->active != NULL) {
+		i2c_bus_abort(bus, I2C_TIMEOUT);
+	}
+	bus->recover_pending = true;
+}
+
+static inline uint32_t i2c_bus_end_mode(i2c_xfer* xfer, I2c_phase phase)
+{
+	// Software end whenever another segment follows, so the TC event can issue the repeated start
+	if ((phase == I2C_PHASE_WRITE && xfer->rx_len) || xfer->next != NULL) {
+		return LL_I2C_MODE_SOFTEND;
+	}
+	return LL_I2C_MODE_AUTOEND;
+}
+
+// Programs the next chunk of the current segment, the hardware then ends or restarts it without the CPU
+static void i2c_bus_load(i2c_bus* bus, uint16_t len, uint32_t request)
+{
+	i2c_xfer* xfer = bus->active;
+	uint32_t end_mode;
+	uint8_t n_bytes;
+
+	if (len > I2C_BUS_MAX_NBYTES) {
+		n_bytes = I2C_BUS_MAX_NBYTES;
+		end_mode = LL_I2C_MODE_RELOAD;
+	} else {
+		n_bytes = len;
+		end_mode = i2c_bus_end_mode(xfer, bus->phase);
+	}
+	bus->reload_len = len - n_bytes;
+	if (request == LL_I2C_GENERATE_NOSTARTSTOP) {
+		// Mid segment only the size & end mode may change, direction & address have to stay as they are
+		MODIFY_REG(bus->i2c_ch->CR2, I2C_CR2_NBYTES | I2C_CR2_RELOAD | I2C_CR2_AUTOEND, ((uint32_t)n_bytes << I2C_CR2_NBYTES_Pos) | end_mode);
+	} else {
+		LL_I2C_HandleTransfer(bus->i2c_ch, xfer->addr << 1U, LL_I2C_ADDRSLAVE_7BIT, n_bytes, end_mode, request);
+	}
+}
+
+static void i2c_bus_start(i2c_bus* bus, bool restart)
+{
+	i2c_xfer* xfer = bus->active;
+
+	bus->tx_idx = 0;
+	bus->rx_idx = 0;
+	bus->result = I2C_OK;
+	// A retry keeps the original start, so both the deadline & the latency cover every attempt
+	if (!bus->retried) {
+		i2c_bus_arm_deadline(bus);
+	}
+	i2c_bus_enable_it(bus);
+
+	// Both channels are armed up front, each only moves data once the I2C raises its request
+	if (bus->dma != NULL) {
+		i2c_bus_dma_stop(bus); // Previous link of a chain may have left the other direction armed
+		if (xfer->tx_len) {
+			i2c_bus_dma_start(bus->dma, bus->dma_tx_ch, xfer->tx_buf, xfer->tx_len);
+			LL_I2C_EnableDMAReq_TX(bus->i2c_ch);
+		}
+		if (xfer->rx_len) {
+			i2c_bus_dma_start(bus->dma, bus->dma_rx_ch, xfer->rx_buf, xfer->rx_len);
+			LL_I2C_EnableDMAReq_RX(bus->i2c_ch);
+		}
+	}
+
+	// Address only probes go out as a zero length write, a zero length read could leave a slave driving SDA
+	if (xfer->tx_len || !xfer->rx_len) {
+		bus->phase = I2C_PHASE_WRITE;
+		i2c_bus_load(bus, xfer->tx_len, restart ? LL_I2C_GENERATE_RESTART_7BIT_WRITE : LL_I2C_GENERATE_START_WRITE);
+	} else {
+		bus->phase = I2C_PHASE_READ;
+		i2c_bus_load(bus, xfer->rx_len, restart ? LL_I2C_GENERATE_RESTART_7BIT_READ : LL_I2C_GENERATE_START_READ);
+	}
+}
+
+static void i2c_bus_complete(i2c_bus* bus, I2c_status status)
+{
+	i2c_xfer* xfer = bus->active;
+	uint32_t cycles = dwt_timer_elapsed(bus->start_cycles);
+
+	i2c_stats_record(&bus->stats, status, cycles);
+	if (xfer->stats != NULL) {
+		i2c_stats_record(xfer->stats, status, cycles);
+	}
+
+	// Rest of a chain carries on, the caller starts the next link
+	if (xfer->next == NULL) {
+		i2c_bus_disable_it(bus->i2c_ch);
+		if (bus->dma != NULL) {
+			i2c_bus_dma_stop(bus);
+		}
+		LL_I2C_ClearFlag_TXE(bus->i2c_ch); // Flush anything left in TXDR after a NACK
+	}
+	bus->active = xfer->next;
+	bus->retried = false;
+
+	xfer->status = status;
+	if (xfer->callback != NULL) {
+		xfer->callback(xfer);
+	}
+}
+
+static inline void i2c_bus_enqueue(i2c_bus* bus, i2c_xfer* xfer)
+{
+	I2c_priority priority = xfer->priority;
+	xfer->queue_next = NULL;
+	if (bus->queue_tail[priority] != NULL) {
+		bus->queue_tail[priority]->queue_next = xfer;
+	} else {
+		bus->queue_head[priority] = xfer;
+	}
+	bus->queue_tail[priority] = xfer;
+}
+
+static inline i2c_xfer* i2c_bus_dequeue(i2c_bus* bus)
+{
+	for (uint8_t priority = 0; priority < I2C_NUM_PRIORITIES; ++priority) {
+		i2c_xfer* xfer = bus->queue_head[priority];
+		if (xfer != NULL) {
+			bus->queue_head[priority] = xfer->queue_next;
+			if (bus->queue_head[priority] == NULL) {
+				bus->queue_tail[priority] = NULL;
+			}
+			return xfer;
+		}
+	}
+	return NULL;
+}
+
+static inline bool i2c_bus_queue_empty(i2c_bus* bus)
+{
+	for (uint8_t priority = 0; priority < I2C_NUM_PRIORITIES; ++priority) {
+		if (bus->queue_head[priority] != NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Called from the ISR once the last link of a transfer has completed
+static void i2c_bus_start_next(i2c_bus* bus)
+{
+	// A completion callback may already have started a new transfer on the free bus
+	if (bus->active != NULL) {
+		return;
+	}
+	bus->active = i2c_bus_dequeue(bus);
+	if (bus->active != NULL) {
+		i2c_bus_start(bus, false);
+	} else {
+		i2c_bus_disarm_deadline(bus);
+	}
+}
+
+// Fails the active link & whatever is chained behind it
+static void i2c_bus_abort(i2c_bus* bus, I2c_status status)
+{
+	i2c_xfer* xfer;
+	do {
+		xfer = bus->active;
+		i2c_bus_complete(bus, status);
+	} while (xfer->next != NULL);
+}
+
+// Bit bangs SCL until a slave holding SDA low lets go, then finishes with a STOP
+static void i2c_bus_clock_out(i2c_bus* bus)
+{
+	GPIO_TypeDef* port = bus->scl_port;
+
+	// Pins are open drain already, so driving them as outputs can only ever pull the lines low
+	LL_GPIO_SetOutputPin(port, bus->scl_pin | bus->sda_pin);
+	LL_GPIO_SetPinMode(port, bus->scl_pin, LL_GPIO_MODE_OUTPUT);
+	LL_GPIO_SetPinMode(port, bus->sda_pin, LL_GPIO_MODE_OUTPUT);
+
+	for (uint8_t i = 0; i < I2C_BUS_RECOVERY_CLOCKS && !LL_GPIO_IsInputPinSet(port, bus->sda_pin); ++i) {
+		LL_GPIO_ResetOutputPin(port, bus->scl_pin);
+		dwt_timer_delay_us(I2C_BUS_RECOVERY_HALF_PERIOD_US);
+		LL_GPIO_SetOutputPin(port, bus->scl_pin);
+		dwt_timer_delay_us(I2C_BUS_RECOVERY_HALF_PERIOD_US);
+	}
+
+	// SDA rising while SCL is high
+	LL_GPIO_ResetOutputPin(port, bus->scl_pin);
+	LL_GPIO_ResetOutputPin(port, bus->sda_pin);
+	dwt_timer_delay_us(I2C_BUS_RECOVERY_HALF_PERIOD_US);
+	LL_GPIO_SetOutputPin(port, bus->scl_pin);
+	dwt_timer_delay_us(I2C_BUS_RECOVERY_HALF_PERIOD_US);
+	LL_GPIO_SetOutputPin(port, bus->sda_pin);
+	dwt_timer_delay_us(I2C_BUS_RECOVERY_HALF_PERIOD_US);
+
+	LL_GPIO_SetPinMode(port, bus->scl_pin, LL_GPIO_MODE_ALTERNATE);
+	LL_GPIO_SetPinMode(port, bus->sda_pin, LL_GPIO_MODE_ALTERNATE);
+}
+
+// Clearing PE is the peripheral's software reset, state machine & flags go but the timing config stays
+static void i2c_bus_reset(I2C_TypeDef* i2c_ch)
+{
+	LL_I2C_Disable(i2c_ch);
+	dwt_timer_delay_us(1); // PE has to stay low for at least 3 APB clocks
+	LL_I2C_Enable(i2c_ch);
+}
+
+static uint32_t i2c_bus_clock_hz(I2C_TypeDef* i2c_ch)
+{
+	return LL_RCC_GetI2CClockFreq(i2c_ch == I2C1 ? LL_RCC_I2C1_CLKSOURCE : LL_RCC_I2C3_CLKSOURCE);
+}
+
+// Rounds towards +infinity for negative numerators too, so a negative minimum clamps to 0 afterwards
+static inline int32_t i2c_bus_div_ceil(int32_t num, int32_t den)
+{
+	return num > 0 ? (num + den - 1) / den : num / den;
+}
+
+void i2c_bus_init(i2c_bus* bus, I2C_TypeDef* i2c_ch)
+{
+	bus->i2c_ch = i2c_ch;
+	bus->active = NULL;
+	bus->phase = I2C_PHASE_WRITE;
+	bus->result = I2C_OK;
+	bus->tx_idx = 0;
+	bus->rx_idx = 0;
+	bus->reload_len = 0;
+	bus->dma = NULL;
+	bus->speed = I2C_SPEED_STANDARD;
+	bus->timeout_us = 0;
+	bus->timeout_cycles = 0;
+	bus->start_cycles = 0;
+	bus->retried = false;
+	bus->recover_pending = false;
+	bus->recovering = false;
+	bus->deadline_tim = NULL;
+	bus->scl_port = NULL;
+	i2c_stats_reset(&bus->stats);
+	for (uint8_t priority = 0; priority < I2C_NUM_PRIORITIES; ++priority) {
+		bus->queue_head[priority] = NULL;
+		bus->queue_tail[priority] = NULL;
+	}
+	i2c_bus_disable_it(i2c_ch);
+}
+
+void i2c_bus_enable_dma(i2c_bus* bus, DMA_TypeDef* dma, uint32_t tx_ch, uint32_t rx_ch, uint32_t request)
+{
+	bus->dma_tx_ch = tx_ch;
+	bus->dma_rx_ch = rx_ch;
+	i2c_bus_dma_config(dma, tx_ch, LL_DMA_DIRECTION_MEMORY_TO_PERIPH,
+		LL_I2C_DMA_GetRegAddr(bus->i2c_ch, LL_I2C_DMA_REG_DATA_TRANSMIT), request);
+	i2c_bus_dma_config(dma, rx_ch, LL_DMA_DIRECTION_PERIPH_TO_MEMORY,
+		LL_I2C_DMA_GetRegAddr(bus->i2c_ch, LL_I2C_DMA_REG_DATA_RECEIVE), request);
+	bus->dma = dma;
+}
+
+void i2c_bus_disable_dma(i2c_bus* bus)
+{
+	if (bus->dma != NULL) {
+		i2c_bus_dma_stop(bus);
+		bus->dma = NULL;
+	}
+}
+
+I2c_status i2c_bus_submit(i2c_bus* bus, i2c_xfer* xfer)
+{
+	// Already queued or in flight, linking it in again would corrupt the queue
+	if (i2c_xfer_pending(xfer)) {
+		return I2C_BUSY;
+	}
+	if (xfer->priority >= I2C_NUM_PRIORITIES) {
+		return I2C_BUS_ERROR;
+	}
+	for (i2c_xfer* link = xfer; link != NULL; link = link->next) {
+		link->status = I2C_PENDING;
+	}
+
+	// Main loop & ISRs can both submit, so the queue & active transfer only change with interrupts masked
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (bus->active == NULL && i2c_bus_queue_empty(bus) && !bus->recover_pending && !LL_I2C_IsActiveFlag_BUSY(bus->i2c_ch)) {
+		bus->active = xfer;
+		i2c_bus_start(bus, false);
+	} else {
+		// Nothing in flight to complete & start it, so the deadline runs from now in case the bus is stuck
+		if (bus->active == NULL && i2c_bus_queue_empty(bus) && !bus->recover_pending) {
+			i2c_bus_arm_deadline(bus);
+		}
+		i2c_bus_enqueue(bus, xfer);
+	}
+	__set_PRIMASK(primask);
+	return I2C_OK;
+}
+
+bool i2c_bus_idle(i2c_bus* bus)
+{
+	return bus->active == NULL && i2c_bus_queue_empty(bus) && !bus->recover_pending && !LL_I2C_IsActiveFlag_BUSY(bus->i2c_ch);
+}
+
+void i2c_bus_set_timeout(i2c_bus* bus, uint32_t timeout_us)
+{
+	I2C_TypeDef* i2c_ch = bus->i2c_ch;
+
+	// Hardware catches a slave stretching SCL low, the cycle deadline catches everything else
+	LL_I2C_DisableSMBusTimeout(i2c_ch, LL_I2C_SMBUS_TIMEOUTA);
+	bus->timeout_us = timeout_us;
+	bus->timeout_cycles = dwt_timer_us_to_cycles(timeout_us);
+	if (timeout_us == 0) {
+		return;
+	}
+
+	uint32_t steps = (uint32_t)(((uint64_t)timeout_us * i2c_bus_clock_hz(i2c_ch)) / (1000000U * I2C_BUS_TIMEOUTA_STEP));
+	uint32_t timeout_a = steps ? steps - 1U : 0;
+	if (timeout_a > I2C_BUS_TIMEOUTA_MAX) {
+		timeout_a = I2C_BUS_TIMEOUTA_MAX;
+	}
+	LL_I2C_ConfigSMBusTimeout(i2c_ch, timeout_a, LL_I2C_SMBUS_TIMEOUTA_MODE_SCL_LOW, 0);
+	LL_I2C_EnableSMBusTimeout(i2c_ch, LL_I2C_SMBUS_TIMEOUTA);
+}
+
+void i2c_bus_set_deadline_timer(i2c_bus* bus, TIM_TypeDef* tim)
+{
+	LL_TIM_DisableCounter(tim);
+	LL_TIM_SetOnePulseMode(tim, LL_TIM_ONEPULSEMODE_SINGLE);
+	// Only the counter running out raises the update, not the re-arms
+	LL_TIM_SetUpdateSource(tim, LL_TIM_UPDATESOURCE_COUNTER);
+	LL_TIM_ClearFlag_UPDATE(tim);
+	LL_TIM_EnableIT_UPDATE(tim);
+	bus->deadline_tim = tim;
+}
+
+I2c_status i2c_bus_set_speed(i2c_bus* bus, I2c_speed speed)
+{
+	I2C_TypeDef* i2c_ch = bus->i2c_ch;
+
+	if (speed >= I2C_NUM_SPEEDS) {
+		return I2C_BUS_ERROR;
+	}
+	uint32_t timing = i2c_bus_compute_timing(i2c_bus_clock_hz(i2c_ch), speed);
+	if (timing == 0) {
+		return I2C_BUS_ERROR;
+	}
+	if (!i2c_bus_idle(bus)) {
+		return I2C_BUSY;
+	}
+
+	// TIMINGR is only writable with the peripheral disabled
+	LL_I2C_Disable(i2c_ch);
+	LL_I2C_SetTiming(i2c_ch, timing);
+	// 1MHz needs the stronger Fm+ pin drivers
+	uint32_t fmp = i2c_ch == I2C1 ? LL_SYSCFG_I2C_FASTMODEPLUS_I2C1 : LL_SYSCFG_I2C_FASTMODEPLUS_I2C3;
+	if (speed == I2C_SPEED_FAST_PLUS) {
+		LL_SYSCFG_EnableFastModePlus(fmp);
+	} else {
+		LL_SYSCFG_DisableFastModePlus(fmp);
+	}
+	LL_I2C_Enable(i2c_ch);
+	bus->speed = speed;
+
+	// TIMEOUTR counts kernel clocks & the deadline core clocks, both may have moved with the clock
+	i2c_bus_set_timeout(bus, bus->timeout_us);
+	return I2C_OK;
+}
+
+/*
+ * Follows the reference manual I2C timing formulas, with tI2CCLK & tPRESC in ps:
+ *   SDADEL >= (tf + tHD;DAT(min) - tAF(min) - (DNF + 3) * tI2CCLK) / tPRESC
+ *   SDADEL <= (tHD;DAT(max) - tr - tAF(max) - (DNF + 4) * tI2CCLK) / tPRESC
+ *   SCLDEL >= (tr + tSU;DAT(min)) / tPRESC - 1
+ *   tLOW = (SCLL + 1) * tPRESC + tSYNC1, tHIGH = (SCLH + 1) * tPRESC + tSYNC2
+ *   tSCL = tLOW + tHIGH + tr + tf >= 1 / f
+ *   tI2CCLK < (tLOW - tAF(max) - DNF * tI2CCLK) / 4, tI2CCLK < tHIGH
+ * with tSYNC taken as tAF(min) + 2 * tI2CCLK. The last pair applies to the tLOW & tHIGH actually programmed, so they
+ * raise the minimums rather than reject the clock, as the reference manual's own 16MHz fast mode plus entry needs.
+ * Only a clock so slow the result is no faster than the next mode down gives 0. The smallest workable prescaler
+ * is used for the finest resolution.
+ */
+uint32_t i2c_bus_compute_timing(uint32_t i2c_clk_hz, I2c_speed speed)
+{
+	if (i2c_clk_hz == 0 || speed >= I2C_NUM_SPEEDS) {
+		return 0;
+	}
+	const i2c_bus_timing_spec* spec = &i2c_bus_timing_specs[speed];
+	int32_t t_clk = (int32_t)(1000000000000ULL / i2c_clk_hz);
+	int32_t t_low_min = spec->t_low_min * 1000;
+	int32_t t_high_min = spec->t_high_min * 1000;
+	int32_t t_r = spec->t_r_max * 1000;
+	int32_t t_f = spec->t_f_max * 1000;
+	int32_t t_af_min = (int32_t)I2C_BUS_TAF_MIN_NS * 1000;
+	int32_t t_af_max = (int32_t)I2C_BUS_TAF_MAX_NS * 1000;
+	int32_t dnf = (int32_t)I2C_BUS_DNF;
+	int32_t t_sync = t_af_min + (2 * t_clk);
+	int32_t t_scl = (int32_t)(1000000000000ULL / spec->freq_hz);
+	int32_t t_filters = t_af_max + (dnf * t_clk);
+	// Kernel clock has to be able to sample SCL low & high a few times over, which the programmed tLOW & tHIGH
+	// have to allow for on top of the spec minimums
+	if (t_low_min <= (4 * t_clk) + t_filters) {
+		t_low_min = (4 * t_clk) + t_filters + 1;
+	}
+	if (t_high_min <= t_clk) {
+		t_high_min = t_clk + 1;
+	}
+	int32_t t_slowest = speed == I2C_SPEED_STANDARD ? 0 : (int32_t)(1000000000000ULL / i2c_bus_timing_specs[speed - 1].freq_hz);
+
+	for (uint32_t presc = 0; presc <= I2C_BUS_PRESC_MAX; ++presc) {
+		int32_t t_presc = (int32_t)(presc + 1U) * t_clk;
+
+		int32_t scldel = i2c_bus_div_ceil(t_r + (spec->t_su_dat_min * 1000), t_presc) - 1;
+		scldel = scldel < 0 ? 0 : scldel;
+
+		int32_t sdadel_min = i2c_bus_div_ceil(t_f + (spec->t_hd_dat_min * 1000) - t_af_min - ((dnf + 3) * t_clk), t_presc);
+		int32_t sdadel_max = ((spec->t_hd_dat_max * 1000) - t_r - t_af_max - ((dnf + 4) * t_clk)) / t_presc;
+		// At high kernel clocks the data valid limit wins over the hold time, which is 0 by the spec anyway. At low
+		// ones the worst case tAF leaves it negative, SDADEL 0 is then as close as it gets (& what the RM table uses)
+		int32_t sdadel = sdadel_min > sdadel_max ? sdadel_max : sdadel_min;
+		sdadel = sdadel < 0 ? 0 : sdadel;
+
+		int32_t scll = i2c_bus_div_ceil(t_low_min - t_sync, t_presc) - 1;
+		int32_t sclh = i2c_bus_div_ceil(t_high_min - t_sync, t_presc) - 1;
+		scll = scll < 0 ? 0 : scll;
+		sclh = sclh < 0 ? 0 : sclh;
+		// Stretch both halves evenly until the period is no shorter than the target
+		int32_t t_period = ((scll + 1) + (sclh + 1)) * t_presc + (2 * t_sync) + t_r + t_f;
+		if (t_period < t_scl) {
+			int32_t extra = i2c_bus_div_ceil(t_scl - t_period, t_presc);
+			scll += extra - (extra / 2);
+			sclh += extra / 2;
+		}
+		// A slow kernel clock stretches tLOW past the spec to sample it, too far & the mode below would do as well
+		int32_t t_low = (scll + 1) * t_presc + t_sync;
+		int32_t t_high = (sclh + 1) * t_presc + t_sync;
+		if (t_slowest != 0 && (t_low + t_high + t_r + t_f) >= t_slowest) {
+			continue;
+		}
+
+		if (scldel <= (int32_t)I2C_BUS_SCLDEL_MAX && sdadel <= (int32_t)I2C_BUS_SDADEL_MAX
+			&& scll <= (int32_t)I2C_BUS_SCLL_MAX && sclh <= (int32_t)I2C_BUS_SCLH_MAX) {
+			return __LL_I2C_CONVERT_TIMINGS(presc, scldel, sdadel, sclh, scll);
+		}
+	}
+	return 0;
+}
+
+void i2c_bus_set_recovery_pins(i2c_bus* bus, GPIO_TypeDef* port, uint32_t scl_pin, uint32_t sda_pin)
+{
+	bus->scl_pin = scl_pin;
+	bus->sda_pin = sda_pin;
+	bus->scl_port = port;
+}
+
+I2c_status i2c_bus_recover(i2c_bus* bus)
+{
+	I2C_TypeDef* i2c_ch = bus->i2c_ch;
+
+	// The pins are only clocked with PE low, so the reset rides along with the clock out
+	if (bus->scl_port != NULL) {
+		LL_I2C_Disable(i2c_ch);
+		i2c_bus_clock_out(bus);
+		LL_I2C_Enable(i2c_ch);
+	} else {
+		i2c_bus_reset(i2c_ch);
+	}
+
+	return LL_I2C_IsActiveFlag_BUSY(i2c_ch) ? I2C_BUS_ERROR : I2C_OK;
+}
+
+void i2c_bus_check_timeout(i2c_bus* bus)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (i2c_bus_expired(bus)) {
+		i2c_bus_expire(bus);
+	}
+	bool recover = bus->recover_pending && !bus->recovering;
+	bus->recovering |= recover;
+	__set_PRIMASK(primask);
+
+	// I2C interrupts are off & submit queues everything while a recovery is pending, so the pins are ours
+	if (recover) {
+		i2c_bus_recover(bus);
+	}
+
+	__disable_irq();
+	if (recover) {
+		bus->recovering = false;
+		bus->recover_pending = false;
+		if (bus->active != NULL) {
+			// The link that hit a bus error gets its one retry, still on its original deadline
+			i2c_bus_start(bus, false);
+		} else {
+			bus->retried = false;
+			i2c_bus_start_next(bus);
+		}
+	} else if (bus->active == NULL && !bus->recover_pending && !i2c_bus_queue_empty(bus) && !LL_I2C_IsActiveFlag_BUSY(bus->i2c_ch)) {
+		// Queued behind a bus that has since gone free, nothing else would start it
+		i2c_bus_start_next(bus);
+	}
+	__set_PRIMASK(primask);
+}
+
+I2c_status i2c_bus_take_errors(I2C_TypeDef* i2c_ch)
+{
+	I2c_status status = I2C_OK;
+
+	// Every flag is cleared, the most specific one is reported
+	if (LL_I2C_IsActiveFlag_OVR(i2c_ch)) {
+		LL_I2C_ClearFlag_OVR(i2c_ch);
+		status = I2C_BUS_ERROR;
+	}
+	if (LL_I2C_IsActiveFlag_BERR(i2c_ch)) {
+		LL_I2C_ClearFlag_BERR(i2c_ch);
+		status = I2C_BUS_ERROR;
+	}
+	if (LL_I2C_IsActiveFlag_ARLO(i2c_ch)) {
+		LL_I2C_ClearFlag_ARLO(i2c_ch);
+		status = I2C_ARB_LOST;
+	}
+	if (LL_I2C_IsActiveSMBusFlag_TIMEOUT(i2c_ch)) {
+		LL_I2C_ClearSMBusFlag_TIMEOUT(i2c_ch);
+		status = I2C_TIMEOUT;
+	}
+	return status;
+}
+
+void i2c_bus_ev_irq_handler(i2c_bus* bus)
+{
+	I2C_TypeDef* i2c_ch = bus->i2c_ch;
+	i2c_xfer* xfer = bus->active;
+
+	if (xfer == NULL) {
+		i2c_bus_disable_it(i2c_ch);
+		return;
+	}
+
+	if (LL_I2C_IsActiveFlag_NACK(i2c_ch)) {
+		// Hardware sends the STOP itself after a NACK, so completion is left to STOPF
+		LL_I2C_ClearFlag_NACK(i2c_ch);
+		bus->result = I2C_NACK;
+	}
+
+	if (bus->dma == NULL && LL_I2C_IsActiveFlag_TXIS(i2c_ch)) {
+		LL_I2C_TransmitData8(i2c_ch, xfer->tx_buf[bus->tx_idx++]);
+	}
+
+	if (bus->dma == NULL && LL_I2C_IsActiveFlag_RXNE(i2c_ch)) {
+		xfer->rx_buf[bus->rx_idx++] = LL_I2C_ReceiveData8(i2c_ch);
+	}
+
+	// Reload mode chunk done, the segment carries on with no START or STOP in between
+	if (LL_I2C_IsActiveFlag_TCR(i2c_ch)) {
+		i2c_bus_load(bus, bus->reload_len, LL_I2C_GENERATE_NOSTARTSTOP);
+	}
+
+	// Only raised in software end mode, once a segment with more to follow has gone out
+	if (LL_I2C_IsActiveFlag_TC(i2c_ch)) {
+		if (bus->phase == I2C_PHASE_WRITE && xfer->rx_len) {
+			bus->phase = I2C_PHASE_READ;
+			i2c_bus_load(bus, xfer->rx_len, LL_I2C_GENERATE_RESTART_7BIT_READ);
+		} else {
+			// Let DMA collect the last byte before its channel is re-armed for the next link
+			if (bus->dma != NULL && !i2c_bus_dma_drain(bus)) {
+				bus->result = I2C_BUS_ERROR;
+			}
+			i2c_bus_complete(bus, bus->result);
+			i2c_bus_start(bus, true);
+		}
+	}
+
+	if (LL_I2C_IsActiveFlag_STOP(i2c_ch)) {
+		LL_I2C_ClearFlag_STOP(i2c_ch);
+		bool chained = xfer->next != NULL;
+		i2c_bus_complete(bus, bus->result);
+		// A NACK mid chain still ends in a STOP, the remaining links get a fresh start
+		if (chained) {
+			i2c_bus_start(bus, false);
+		} else {
+			i2c_bus_start_next(bus);
+		}
+	}
+}
+
+void i2c_bus_er_irq_handler(i2c_bus* bus)
+{
+	I2C_TypeDef* i2c_ch = bus->i2c_ch;
+	I2c_status status = i2c_bus_take_errors(i2c_ch);
+
+	if (bus->active == NULL) {
+		i2c_bus_disable_it(i2c_ch);
+		return;
+	}
+	// Flags already cleared, nothing went wrong that a retry would help
+	if (status == I2C_OK) {
+		return;
+	}
+
+	// Another master won the bus, it isn't stuck & clocking it out would wreck that master's transfer. The link
+	// fails & the hardware has already dropped back to slave mode, so anything queued waits for the other STOP
+	if (status == I2C_ARB_LOST) {
+		bool busy = LL_I2C_IsActiveFlag_BUSY(i2c_ch);
+		i2c_bus_abort(bus, I2C_ARB_LOST);
+		if (busy && !i2c_bus_queue_empty(bus)) {
+			i2c_bus_arm_deadline(bus);
+		} else {
+			i2c_bus_start_next(bus);
+		}
+		return;
+	}
+
+	// Glitches & stuck slaves usually clear after a recovery, so the link gets one more go. The recovery bit bangs
+	// the pins with busy waits, so it's left to i2c_bus_check_timeout & the interrupt just wakes the core
+	if (!bus->retried) {
+		bus->retried = true;
+		++bus->stats.retries;
+		if (bus->active->stats != NULL) {
+			++bus->active->stats->retries;
+		}
+		i2c_bus_disable_it(i2c_ch);
+		bus->recover_pending = true;
+		return;
+	}
+
+	// Second fault on the link, the peripheral is reset so the next transfer doesn't inherit its state
+	i2c_bus_abort(bus, status);
+	i2c_bus_reset(i2c_ch);
+	i2c_bus_start_next(bus);
+}
+
+void i2c_bus_deadline_irq_handler(i2c_bus* bus)
+{
+	TIM_TypeDef* tim = bus->deadline_tim;
+
+	if (!LL_TIM_IsActiveFlag_UPDATE(tim)) {
+		return;
+	}
+	LL_TIM_ClearFlag_UPDATE(tim);
+	if (bus->active == NULL && i2c_bus_queue_empty(bus)) {
+		return;
+	}
+	if (i2c_bus_expired(bus)) {
+		i2c_bus_expire(bus);
+		return;
+	}
+	// Deadline is further out than one lap of the timer, or the clocks disagree by a tick
+	uint32_t elapsed = dwt_timer_elapsed(bus->start_cycles);
+	uint32_t left = elapsed < bus->timeout_cycles ? bus->timeout_cycles - elapsed : 0;
+	i2c_bus_deadline_start(tim, dwt_timer_cycles_to_us(left) + 1U);
+}
+
+uint8_t i2c_bus_scan(i2c_bus* bus, uint8_t first_addr, uint8_t last_addr, uint8_t* found, uint8_t max_found)
+{
+	i2c_xfer probes[I2C_BUS_SCAN_BATCH];
+	uint8_t n_found = 0;
+	// Probing a reserved address could wake a CBUS or high speed device, or look like a general call
+	uint16_t addr = first_addr < I2C_BUS_ADDR_MIN ? I2C_BUS_ADDR_MIN : first_addr;
+	last_addr = last_addr > I2C_BUS_ADDR_MAX ? I2C_BUS_ADDR_MAX : last_addr;
+
+	while (addr <= last_addr) {
+		uint8_t n_probes = 0;
+		// Each batch is one chained transaction, an address byte per device & a single STOP if they all ACK
+		for (; n_probes < I2C_BUS_SCAN_BATCH && addr <= last_addr; ++n_probes, ++addr) {
+			i2c_xfer* probe = &probes[n_probes];
+			memset(probe, 0, sizeof(*probe));
+			probe->addr = addr;
+			probe->priority = I2C_PRIORITY_CONFIG;
+			if (n_probes) {
+				probes[n_probes - 1U].next = probe;
+			}
+		}
+
+		if (i2c_bus_submit(bus, probes) != I2C_OK) {
+			break;
+		}
+		while (i2c_xfer_pending(&probes[n_probes - 1U])) {
+			i2c_bus_check_timeout(bus);
+		}
+
+		for (uint8_t i = 0; i < n_probes; ++i) {
+			if (probes[i].status == I2C_OK && n_found < max_found) {
+				found[n_found++] = probes[i].addr;
+			}
+		}
+	}
+	return n_found;
+}
+
+void i2c_bus_get_stats(i2c_bus* bus, i2c_stats* stats)
+{
+	i2c_stats_snapshot(&bus->stats, stats);
+}
+
+void i2c_stats_reset(i2c_stats* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->min_cycles = UINT32_MAX;
+}
+
+void i2c_stats_record(i2c_stats* stats, I2c_status status, uint32_t cycles)
+{
+	++stats->transfers;
+	switch (status) {
+	case I2C_OK:
+		break;
+	case I2C_NACK:
+		++stats->nacks;
+		break;
+	case I2C_TIMEOUT:
+		++stats->timeouts;
+		break;
+	case I2C_ARB_LOST:
+		++stats->arb_losts;
+		break;
+	default:
+		++stats->bus_errors;
+		break;
+	}
+
+	if (cycles < stats->min_cycles) {
+		stats->min_cycles = cycles;
+	}
+	if (cycles > stats->max_cycles) {
+		stats->max_cycles = cycles;
+	}
+	stats->total_cycles += cycles;
+}
+
+void i2c_stats_snapshot(i2c_stats* stats, i2c_stats* copy)
+{
+	// Counters are updated from the I2C ISR, copy them in one go so they all agree
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	*copy = *stats;
+	__set_PRIMASK(primask);
+}
+
+uint32_t i2c_stats_avg_cycles(i2c_stats* stats)
+{
+	return stats->transfers ? (uint32_t)(stats->total_cycles / stats->transfers) : 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * fake_hd44780.c
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+#include "fake_hd44780.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FAKE_HD44780_MODE_MASK 0x3U
+#define FAKE_HD44780_MODE_OUTPUT 0x1U
+
+static fake_hd44780* fake_hd44780_hooked;
+
+static void fake_hd44780_log(fake_hd44780* fake, const char* fmt, ...);
+static uint32_t fake_hd44780_pin_mode(fake_hd44780* fake, uint32_t pin);
+static void fake_hd44780_set_mode(fake_hd44780* fake, uint32_t pin, uint32_t mode);
+static uint32_t fake_hd44780_data_pins(fake_hd44780* fake);
+static bool fake_hd44780_data_mode_is(fake_hd44780* fake, uint32_t mode);
+static uint8_t fake_hd44780_nibble_in(fake_hd44780* fake);
+static uint32_t fake_hd44780_nibble_out(fake_hd44780* fake, uint8_t nibble);
+static bool fake_hd44780_busy(fake_hd44780* fake, uint32_t now);
+static void fake_hd44780_execute(fake_hd44780* fake, uint8_t byte, bool data, uint32_t now);
+static void fake_hd44780_latch(fake_hd44780* fake, uint32_t now);
+static void fake_hd44780_time_hook(void);
+
+static void fake_hd44780_log(fake_hd44780* fake, const char* fmt, ...)
+{
+	va_list args;
+	size_t room = FAKE_HD44780_LOG_SIZE - fake->log_len;
+
+	if (fake->log_len && room > 1U) {
+		fake->log[fake->log_len++] = ' ';
+		--room;
+	}
+	va_start(args, fmt);
+	int len = vsnprintf(&fake->log[fake->log_len], room, fmt, args);
+	va_end(args);
+	if (len > 0) {
+		fake->log_len += (uint16_t)len < room ? (uint16_t)len : (uint16_t)(room - 1U);
+	}
+}
+
+static uint32_t fake_hd44780_pin_mode(fake_hd44780* fake, uint32_t pin)
+{
+	return (fake->regs.MODER >> (2U * (uint32_t)__builtin_ctz(pin))) & FAKE_HD44780_MODE_MASK;
+}
+
+static void fake_hd44780_set_mode(fake_hd44780* fake, uint32_t pin, uint32_t mode)
+{
+	if (!pin) {
+		return;
+	}
+	uint32_t shift = 2U * (uint32_t)__builtin_ctz(pin);
+	fake->regs.MODER = (fake->regs.MODER & ~(FAKE_HD44780_MODE_MASK << shift)) | (mode << shift);
+}
+
+static uint32_t fake_hd44780_data_pins(fake_hd44780* fake)
+{
+	hd44780u* display = fake->display;
+	return display->d4_pin | display->d5_pin | display->d6_pin | display->d7_pin;
+}
+
+static bool fake_hd44780_data_mode_is(fake_hd44780* fake, uint32_t mode)
+{
+	hd44780u* display = fake->display;
+	return fake_hd44780_pin_mode(fake, display->d4_pin) == mode && fake_hd44780_pin_mode(fake, display->d5_pin) == mode
+		&& fake_hd44780_pin_mode(fake, display->d6_pin) == mode && fake_hd44780_pin_mode(fake, display->d7_pin) == mode;
+}
+
+static uint8_t fake_hd44780_nibble_in(fake_hd44780* fake)
+{
+	hd44780u* display = fake->display;
+	uint32_t odr = fake->regs.ODR;
+
+	return (uint8_t)(((odr & display->d4_pin) ? 0x1U : 0U) | ((odr & display->d5_pin) ? 0x2U : 0U)
+		| ((odr & display->d6_pin) ? 0x4U : 0U) | ((odr & display->d7_pin) ? 0x8U : 0U));
+}
+
+static uint32_t fake_hd44780_nibble_out(fake_hd44780* fake, uint8_t nibble)
+{
+	hd44780u* display = fake->display;
+
+	return ((nibble & 0x1U) ? display->d4_pin : 0U) | ((nibble & 0x2U) ? display->d5_pin : 0U)
+		| ((nibble & 0x4U) ? display->d6_pin : 0U) | ((nibble & 0x8U) ? display->d7_pin : 0U);
+}
+
+static bool fake_hd44780_busy(fake_hd44780* fake, uint32_t now)
+{
+	return fake->stuck_busy || (int32_t)(now - fake->busy_until) < 0;
+}
+
+static void fake_hd44780_execute(fake_hd44780* fake, uint8_t byte, bool data, uint32_t now)
+{
+	uint32_t exec_us = fake->exec_us;
+
+	++fake->instructions;
+	if (fake_hd44780_busy(fake, now)) {
+		++fake->busy_writes;
+		fake_hd44780_log(fake, "!");
+		return;
+	}
+	fake->last_ac = fake->ac;
+
+	if (data) {
+		fake_hd44780_log(fake, "'%c'", byte);
+		fake->ddram[fake->ac & 0x7FU] = byte;
+		fake->ac = (fake->ac + 1U) & 0x7FU;
+	} else {
+		fake_hd44780_log(fake, "%02X", byte);
+		if (byte & HD44780U_SET_DDRAM_ADDR) {
+			fake->ac = byte & 0x7FU;
+		} else if (byte & HD44780U_SET_CGRAM_ADDR) {
+			// CGRAM isn't modelled
+		} else if (byte & HD47780U_FUNCTION_SET) {
+			fake->four_bit = !(byte & HD44780U_8_BIT_INTERFACE);
+		} else if (byte & HD44780U_SHIFT_CTRL) {
+			if (!(byte & HD44780U_DISPLAY_SHIFT)) {
+				fake->ac = (byte & HD44780U_SHIFT_RIGHT) ? fake->ac + 1U : fake->ac - 1U;
+				fake->ac &= 0x7FU;
+			}
+		} else if (byte & HD44780U_DISPLAY_CTRL) {
+			fake->display_ctrl = byte;
+		} else if (byte & HD44780U_ENTRY_MODE_SET) {
+			// Only increment without shift is modelled
+		} else if (byte & HD44780U_RETURN_HOME) {
+			fake->ac = 0;
+			exec_us = fake->clear_home_us;
+		} else if (byte & HD44780U_DISPLAY_CLEAR) {
+			memset(fake->ddram, ' ', sizeof(fake->ddram));
+			fake->ac = 0;
+			exec_us = fake->clear_home_us;
+		}
+	}
+	fake->busy_until = now + dwt_timer_us_to_cycles(exec_us);
+}
+
+// EN falling, a write latches the data pins. Until a 4 bit function set each edge is a whole 8 bit instruction
+// with only D7-D4 wired
+static void fake_hd44780_latch(fake_hd44780* fake, uint32_t now)
+{
+	hd44780u* display = fake->display;
+	bool data = fake->regs.ODR & display->rs_pin;
+
+	if (display->rw_pin && (fake->regs.ODR & display->rw_pin)) {
+		fake->read_nibble ^= 1U;
+		return;
+	}
+	if (!fake_hd44780_data_mode_is(fake, FAKE_HD44780_MODE_OUTPUT)) {
+		++fake->undriven;
+	}
+	uint8_t nibble = fake_hd44780_nibble_in(fake);
+	if (!fake->four_bit) {
+		fake_hd44780_execute(fake, (uint8_t)(nibble << 4U), data, now);
+		return;
+	}
+	if (!fake->second_nibble) {
+		fake->first_nibble = nibble;
+		fake->second_nibble = true;
+		return;
+	}
+	fake->second_nibble = false;
+	fake_hd44780_execute(fake, (uint8_t)((fake->first_nibble << 4U) | nibble), data, now);
+}
+
+static void fake_hd44780_time_hook(void)
+{
+	fake_hd44780* fake = fake_hd44780_hooked;
+	hd44780u* display = fake->display;
+	GPIO_TypeDef* regs = &fake->regs;
+	// Stores land between the driver's delays, so at the time the model last looked
+	uint32_t now = fake->seen_cycles;
+
+	// BSRR & BRR are write only, the model just sees the last word stored to each since it last looked. The end of
+	// a status read releases R/W through BRR & a write's RS low can follow before any delay, so a BRR store while
+	// the data pins went from inputs back to outputs stands in for the lost R/W release
+	bool data_out = fake_hd44780_data_mode_is(fake, FAKE_HD44780_MODE_OUTPUT);
+	if (regs->BRR && !fake->data_out && data_out) {
+		regs->BRR |= display->rw_pin;
+	}
+	fake->data_out = data_out;
+	regs->ODR &= ~(regs->BSRR >> 16U);
+	regs->ODR &= ~regs->BRR;
+	regs->ODR |= regs->BSRR & 0xFFFFU;
+	regs->BSRR = 0;
+	regs->BRR = 0;
+
+	bool en_high = regs->ODR & display->en_pin;
+	bool read = display->rw_pin && (regs->ODR & display->rw_pin);
+	uint32_t idr = regs->ODR;
+	if (en_high && read) {
+		if (!fake->en_high) {
+			fake->en_rise = now;
+			++fake->status_reads;
+			if (!fake_hd44780_data_mode_is(fake, 0U)) {
+				++fake->contention;
+			}
+		}
+		// BF & the address counter for RS low, a DDRAM read isn't modelled
+		uint8_t ac = (int32_t)(now - fake->busy_until - dwt_timer_ns_to_cycles(FAKE_HD44780_ADDR_LAG_NS)) < 0
+			? fake->last_ac : fake->ac;
+		uint8_t status = (fake_hd44780_busy(fake, now) ? HD44780U_BUSY_FLAG : 0U) | ac;
+		uint8_t nibble = fake->read_nibble ? status & 0xFU : status >> 4U;
+		// IDR is what the driver reads next, which is now rather than when the stores were made
+		if (host_cycles - fake->en_rise < dwt_timer_ns_to_cycles(FAKE_HD44780_DATA_DELAY_NS)) {
+			nibble = (uint8_t)~nibble;
+		}
+		idr = (idr & ~fake_hd44780_data_pins(fake)) | fake_hd44780_nibble_out(fake, nibble);
+	}
+	regs->IDR = idr;
+
+	if (fake->en_high && !en_high) {
+		fake_hd44780_latch(fake, now);
+	}
+	fake->en_high = en_high;
+	fake->seen_cycles = host_cycles;
+}
+
+void fake_hd44780_init(fake_hd44780* fake, hd44780u* display)
+{
+	memset(fake, 0, sizeof(*fake));
+	memset(fake->ddram, ' ', sizeof(fake->ddram));
+	fake->display = display;
+	fake->exec_us = HD44780U_EXEC_US;
+	fake->clear_home_us = HD44780U_CLEAR_HOME_US;
+	fake->seen_cycles = host_cycles;
+	fake->busy_until = host_cycles;
+	fake->data_out = true;
+	display->port = &fake->regs;
+	fake_hd44780_set_mode(fake, display->en_pin, FAKE_HD44780_MODE_OUTPUT);
+	fake_hd44780_set_mode(fake, display->rs_pin, FAKE_HD44780_MODE_OUTPUT);
+	fake_hd44780_set_mode(fake, display->rw_pin, FAKE_HD44780_MODE_OUTPUT);
+	fake_hd44780_set_mode(fake, display->d4_pin, FAKE_HD44780_MODE_OUTPUT);
+	fake_hd44780_set_mode(fake, display->d5_pin, FAKE_HD44780_MODE_OUTPUT);
+	fake_hd44780_set_mode(fake, display->d6_pin, FAKE_HD44780_MODE_OUTPUT);
+	fake_hd44780_set_mode(fake, display->d7_pin, FAKE_HD44780_MODE_OUTPUT);
+	fake_hd44780_hooked = fake;
+	host_time_hook = fake_hd44780_time_hook;
+}
+
+void fake_hd44780_clear_log(fake_hd44780* fake)
+{
+	fake->log[0] = '\0';
+	fake->log_len = 0;
+}
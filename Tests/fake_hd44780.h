@@ -0,0 +1,58 @@
+/*
+ * fake_hd44780.h
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+// Pin level model of an HD44780U on a GPIO_TypeDef in RAM. It watches the driver's BSRR/BRR stores for EN edges,
+// latches instructions & data on the falling edge (8 bit until a 4 bit function set, then nibble pairs) & drives
+// BF & the address counter onto the data pins' IDR bits for reads, once the data delay after EN rises is up. Every instruction keeps BF set for its execution
+// time, anything written while it's set is ignored & counted, as a real controller would drop it
+
+#ifndef FAKE_HD44780_H_
+#define FAKE_HD44780_H_
+
+#include "hd44780u_driver.h"
+
+#define FAKE_HD44780_DDRAM_SIZE 0x80U
+#define FAKE_HD44780_LOG_SIZE 256U
+// Address counter updates 1.5 oscillator clocks after BF clears, at the nominal 270kHz
+#define FAKE_HD44780_ADDR_LAG_NS 5500U
+// Data output delay after EN rises on a read, the pins hold garbage until then
+#define FAKE_HD44780_DATA_DELAY_NS 360U
+
+typedef struct {
+	GPIO_TypeDef regs;
+	hd44780u* display; // Pin mapping to decode
+	bool four_bit;
+	bool second_nibble;
+	uint8_t first_nibble;
+	uint8_t read_nibble; // 0 for BF & AC 6-4, 1 for AC 3-0
+	bool en_high;
+	bool data_out; // Data pins were outputs when the model last looked
+	uint32_t en_rise;
+	uint8_t ac;
+	uint8_t last_ac; // What a read returns until the address counter catches up after BF clears
+	uint8_t ddram[FAKE_HD44780_DDRAM_SIZE];
+	uint8_t display_ctrl;
+	uint32_t exec_us; // Execution times the model keeps BF set for, the datasheet's by default
+	uint32_t clear_home_us;
+	bool stuck_busy; // BF never clears, like a controller that has locked up
+	uint32_t busy_until;
+	uint32_t seen_cycles; // Last time the model looked, any stores since were made at this time
+	uint32_t instructions;
+	uint32_t busy_writes; // Dropped, written while BF was set
+	uint32_t status_reads;
+	uint32_t contention; // Controller driving the data pins while they were still outputs
+	uint32_t undriven; // Written while a data pin was still an input
+	char log[FAKE_HD44780_LOG_SIZE]; // Instructions as hex & characters quoted, e.g. "28 08 01 06 'A'"
+	uint16_t log_len;
+} fake_hd44780;
+
+// Also installs the time hook, so only one fake at a time. The data, RS, R/W & EN pins start as outputs, as
+// MX_GPIO_Init leaves them
+void fake_hd44780_init(fake_hd44780* fake, hd44780u* display);
+void fake_hd44780_clear_log(fake_hd44780* fake);
+
+#endif
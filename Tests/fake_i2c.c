@@ -0,0 +1,391 @@
+/*
+ * fake_i2c.c
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+#include "fake_i2c.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FAKE_I2C_ERROR_FLAGS (I2C_ISR_BERR | I2C_ISR_ARLO | I2C_ISR_OVR | I2C_ISR_TIMEOUT)
+#define FAKE_I2C_MAX_STEPS 100000U
+#define FAKE_I2C_MAX_WAITS 1000000U
+
+static fake_i2c* fake_i2c_hooked;
+
+static void fake_i2c_log(fake_i2c* fake, const char* fmt, ...);
+static uint32_t fake_i2c_enable_bit(uint32_t flag);
+static void fake_i2c_raise(fake_i2c* fake, uint32_t flag);
+static void fake_i2c_time_hook(void);
+static Fake_i2c_fault fake_i2c_fault_hit(fake_i2c* fake);
+static void fake_i2c_stop(fake_i2c* fake);
+static void fake_i2c_nack(fake_i2c* fake);
+static void fake_i2c_fail(fake_i2c* fake, Fake_i2c_fault fault);
+static void fake_i2c_end_chunk(fake_i2c* fake);
+static void fake_i2c_start(fake_i2c* fake);
+static void fake_i2c_write_byte(fake_i2c* fake);
+static void fake_i2c_read_byte(fake_i2c* fake);
+
+static void fake_i2c_log(fake_i2c* fake, const char* fmt, ...)
+{
+	va_list args;
+	size_t room = FAKE_I2C_LOG_SIZE - fake->log_len;
+
+	if (fake->log_len && room > 1U) {
+		fake->log[fake->log_len++] = ' ';
+		--room;
+	}
+	va_start(args, fmt);
+	int len = vsnprintf(&fake->log[fake->log_len], room, fmt, args);
+	va_end(args);
+	if (len > 0) {
+		fake->log_len += (uint16_t)len < room ? (uint16_t)len : (uint16_t)(room - 1U);
+	}
+}
+
+static uint32_t fake_i2c_enable_bit(uint32_t flag)
+{
+	switch (flag) {
+	case I2C_ISR_TXIS:
+		return I2C_CR1_TXIE;
+	case I2C_ISR_RXNE:
+		return I2C_CR1_RXIE;
+	case I2C_ISR_TC:
+	case I2C_ISR_TCR:
+		return I2C_CR1_TCIE;
+	case I2C_ISR_STOPF:
+		return I2C_CR1_STOPIE;
+	case I2C_ISR_NACKF:
+		return I2C_CR1_NACKIE;
+	default:
+		return I2C_CR1_ERRIE;
+	}
+}
+
+// Sets the flag & takes the interrupt if it's enabled, then clears whatever the driver wrote to ICR
+static void fake_i2c_raise(fake_i2c* fake, uint32_t flag)
+{
+	I2C_TypeDef* regs = &fake->regs;
+
+	regs->ISR |= flag;
+	if (regs->CR1 & fake_i2c_enable_bit(flag)) {
+		bool in_hook = fake->in_hook;
+		++fake->irqs;
+		fake->in_hook = true;
+		if (flag & FAKE_I2C_ERROR_FLAGS) {
+			i2c_bus_er_irq_handler(fake->bus);
+		} else {
+			i2c_bus_ev_irq_handler(fake->bus);
+		}
+		fake->in_hook = in_hook;
+	}
+	regs->ISR &= ~regs->ICR;
+	regs->ICR = 0;
+}
+
+// The hardware carries on while the driver busy waits, one event per look at the clock unless interrupts are
+// masked or an ISR is already running. PE low is the software reset, only ever seen inside recovery delays
+static void fake_i2c_time_hook(void)
+{
+	fake_i2c* fake = fake_i2c_hooked;
+
+	if (fake == NULL) {
+		return;
+	}
+	if (fake->regs.CR1 & I2C_CR1_PE) {
+		fake->in_reset = false;
+		if (fake->concurrent && !fake->in_hook && host_primask == 0) {
+			fake->in_hook = true;
+			fake_i2c_step(fake);
+			fake->in_hook = false;
+		}
+		return;
+	}
+	if (!fake->in_reset) {
+		fake->in_reset = true;
+		++fake->resets;
+		fake->regs.ISR = I2C_ISR_TXE;
+		fake->regs.CR2 &= ~(I2C_CR2_START | I2C_CR2_STOP);
+		fake->state = FAKE_I2C_IDLE;
+		fake->target = NULL;
+		fake_i2c_log(fake, "R");
+	}
+}
+
+static Fake_i2c_fault fake_i2c_fault_hit(fake_i2c* fake)
+{
+	if (fake->fault_count == 0 || fake->byte_idx != fake->fault_byte) {
+		return FAKE_I2C_FAULT_NONE;
+	}
+	--fake->fault_count;
+	return fake->fault;
+}
+
+static void fake_i2c_stop(fake_i2c* fake)
+{
+	fake->regs.CR2 &= ~I2C_CR2_STOP;
+	fake->regs.ISR &= ~(I2C_ISR_BUSY | I2C_ISR_TC);
+	fake->state = FAKE_I2C_IDLE;
+	fake->target = NULL;
+	fake_i2c_log(fake, "P");
+	fake_i2c_raise(fake, I2C_ISR_STOPF);
+}
+
+// The master always follows a NACK with a STOP of its own
+static void fake_i2c_nack(fake_i2c* fake)
+{
+	fake_i2c_log(fake, "N");
+	fake_i2c_raise(fake, I2C_ISR_NACKF);
+	fake_i2c_stop(fake);
+}
+
+static void fake_i2c_fail(fake_i2c* fake, Fake_i2c_fault fault)
+{
+	fake->state = FAKE_I2C_IDLE;
+	fake->target = NULL;
+	switch (fault) {
+	case FAKE_I2C_FAULT_BERR:
+		fake_i2c_log(fake, "E");
+		fake->regs.ISR &= ~I2C_ISR_BUSY;
+		fake_i2c_raise(fake, I2C_ISR_BERR);
+		break;
+	case FAKE_I2C_FAULT_ARLO:
+		// Losing arbitration drops the peripheral back to slave mode, the other master owns the bus
+		fake_i2c_log(fake, "A");
+		fake->state = FAKE_I2C_OTHER_MASTER;
+		fake_i2c_raise(fake, I2C_ISR_ARLO);
+		break;
+	case FAKE_I2C_FAULT_TIMEOUT:
+		// A master sends a STOP itself once TIMEOUTA runs out
+		fake_i2c_log(fake, "T");
+		fake->regs.ISR &= ~I2C_ISR_BUSY;
+		fake_i2c_raise(fake, I2C_ISR_TIMEOUT);
+		break;
+	default:
+		fake_i2c_log(fake, "X");
+		fake->state = FAKE_I2C_STUCK;
+		break;
+	}
+}
+
+static void fake_i2c_end_chunk(fake_i2c* fake)
+{
+	I2C_TypeDef* regs = &fake->regs;
+
+	if (regs->CR2 & I2C_CR2_RELOAD) {
+		fake_i2c_raise(fake, I2C_ISR_TCR);
+		// Writing a non zero NBYTES is what clears TCR
+		fake->remaining = (regs->CR2 & I2C_CR2_NBYTES) >> I2C_CR2_NBYTES_Pos;
+		regs->ISR &= ~I2C_ISR_TCR;
+		if (fake->remaining == 0) {
+			fake_i2c_log(fake, "?");
+			fake->state = FAKE_I2C_STUCK;
+		}
+		return;
+	}
+	if (regs->CR2 & I2C_CR2_AUTOEND) {
+		fake_i2c_stop(fake);
+		return;
+	}
+	// SCL is stretched until the driver sets START or STOP, the next step picks either up
+	fake->state = FAKE_I2C_WAIT_TC;
+	fake_i2c_raise(fake, I2C_ISR_TC);
+}
+
+static void fake_i2c_start(fake_i2c* fake)
+{
+	I2C_TypeDef* regs = &fake->regs;
+	bool restart = (regs->ISR & I2C_ISR_BUSY) != 0;
+	uint8_t addr = (uint8_t)((regs->CR2 & I2C_CR2_SADD) >> 1U) & 0x7FU;
+
+	regs->CR2 &= ~I2C_CR2_START;
+	regs->ISR &= ~I2C_ISR_TC;
+	regs->ISR |= I2C_ISR_BUSY;
+	fake->read = (regs->CR2 & I2C_CR2_RD_WRN) != 0;
+	fake->remaining = (regs->CR2 & I2C_CR2_NBYTES) >> I2C_CR2_NBYTES_Pos;
+	fake->byte_idx = 0;
+	fake->target = NULL;
+	for (uint8_t i = 0; i < FAKE_I2C_MAX_SLAVES; ++i) {
+		if (fake->slaves[i].present && fake->slaves[i].addr == addr) {
+			fake->target = &fake->slaves[i];
+		}
+	}
+	fake_i2c_log(fake, "%s%02X%c", restart ? "Sr" : "S", addr, fake->read ? 'r' : 'w');
+
+	Fake_i2c_fault fault = fake_i2c_fault_hit(fake);
+	if (fault != FAKE_I2C_FAULT_NONE && fault != FAKE_I2C_FAULT_NACK) {
+		fake_i2c_fail(fake, fault);
+		return;
+	}
+	if (fake->target == NULL || fault == FAKE_I2C_FAULT_NACK) {
+		fake_i2c_nack(fake);
+		return;
+	}
+	if (!fake->read) {
+		fake->target->ptr_set = false;
+	}
+	fake->state = fake->read ? FAKE_I2C_READ : FAKE_I2C_WRITE;
+	if (fake->remaining == 0) {
+		fake_i2c_end_chunk(fake);
+	}
+}
+
+static void fake_i2c_write_byte(fake_i2c* fake)
+{
+	I2C_TypeDef* regs = &fake->regs;
+	fake_i2c_slave* slave = fake->target;
+
+	++fake->byte_idx;
+	Fake_i2c_fault fault = fake_i2c_fault_hit(fake);
+	if (fault != FAKE_I2C_FAULT_NONE && fault != FAKE_I2C_FAULT_NACK) {
+		fake_i2c_fail(fake, fault);
+		return;
+	}
+
+	regs->TXDR = FAKE_I2C_TXDR_EMPTY;
+	fake_i2c_raise(fake, I2C_ISR_TXIS);
+	regs->ISR &= ~I2C_ISR_TXIS;
+	if (regs->TXDR == FAKE_I2C_TXDR_EMPTY) {
+		fake_i2c_log(fake, "?");
+		fake->state = FAKE_I2C_STUCK;
+		return;
+	}
+	uint8_t byte = (uint8_t)regs->TXDR;
+	fake_i2c_log(fake, "%02X", byte);
+
+	if (fault == FAKE_I2C_FAULT_NACK) {
+		fake_i2c_nack(fake);
+		return;
+	}
+	if (!slave->ptr_set) {
+		slave->ptr = byte % FAKE_I2C_NUM_REGS;
+		slave->ptr_set = true;
+	} else {
+		slave->regs[slave->ptr] = byte;
+		slave->ptr = (slave->ptr + 1U) % FAKE_I2C_NUM_REGS;
+	}
+	if (--fake->remaining == 0) {
+		fake_i2c_end_chunk(fake);
+	}
+}
+
+static void fake_i2c_read_byte(fake_i2c* fake)
+{
+	I2C_TypeDef* regs = &fake->regs;
+	fake_i2c_slave* slave = fake->target;
+
+	++fake->byte_idx;
+	Fake_i2c_fault fault = fake_i2c_fault_hit(fake);
+	// The master ACKs on a read, so there's no NACK to inject here
+	if (fault != FAKE_I2C_FAULT_NONE && fault != FAKE_I2C_FAULT_NACK) {
+		fake_i2c_fail(fake, fault);
+		return;
+	}
+
+	uint8_t byte = slave->regs[slave->ptr];
+	slave->ptr = (slave->ptr + 1U) % FAKE_I2C_NUM_REGS;
+	regs->RXDR = byte;
+	fake_i2c_log(fake, "%02X", byte);
+	fake_i2c_raise(fake, I2C_ISR_RXNE);
+	regs->ISR &= ~I2C_ISR_RXNE;
+	if (--fake->remaining == 0) {
+		fake_i2c_end_chunk(fake);
+	}
+}
+
+void fake_i2c_init(fake_i2c* fake, i2c_bus* bus)
+{
+	memset(fake, 0, sizeof(*fake));
+	fake->bus = bus;
+	fake->regs.CR1 = I2C_CR1_PE;
+	fake->regs.ISR = I2C_ISR_TXE;
+	fake->state = FAKE_I2C_IDLE;
+	fake->concurrent = true;
+	fake_i2c_hooked = fake;
+	host_time_hook = fake_i2c_time_hook;
+}
+
+fake_i2c_slave* fake_i2c_add_slave(fake_i2c* fake, uint8_t addr)
+{
+	for (uint8_t i = 0; i < FAKE_I2C_MAX_SLAVES; ++i) {
+		fake_i2c_slave* slave = &fake->slaves[i];
+		if (!slave->present) {
+			memset(slave, 0, sizeof(*slave));
+			slave->addr = addr;
+			slave->present = true;
+			return slave;
+		}
+	}
+	return NULL;
+}
+
+void fake_i2c_inject(fake_i2c* fake, Fake_i2c_fault fault, uint16_t byte_idx, uint8_t count)
+{
+	fake->fault = fault;
+	fake->fault_byte = byte_idx;
+	fake->fault_count = count;
+}
+
+bool fake_i2c_step(fake_i2c* fake)
+{
+	I2C_TypeDef* regs = &fake->regs;
+
+	if (!(regs->CR1 & I2C_CR1_PE)) {
+		return false;
+	}
+	// A stuck bus ignores START until the peripheral has been reset
+	if (fake->state == FAKE_I2C_STUCK) {
+		return false;
+	}
+	// The winner's STOP, logged lower case as it isn't ours. A START waits for it like the hardware's does
+	if (fake->state == FAKE_I2C_OTHER_MASTER) {
+		regs->ISR &= ~I2C_ISR_BUSY;
+		fake->state = FAKE_I2C_IDLE;
+		fake_i2c_log(fake, "p");
+		return true;
+	}
+	if (regs->CR2 & I2C_CR2_START) {
+		fake_i2c_start(fake);
+		return true;
+	}
+	if (regs->CR2 & I2C_CR2_STOP) {
+		fake_i2c_stop(fake);
+		return true;
+	}
+	switch (fake->state) {
+	case FAKE_I2C_WRITE:
+		fake_i2c_write_byte(fake);
+		return true;
+	case FAKE_I2C_READ:
+		fake_i2c_read_byte(fake);
+		return true;
+	default:
+		return false;
+	}
+}
+
+uint32_t fake_i2c_run(fake_i2c* fake)
+{
+	uint32_t steps = 0;
+	while (steps < FAKE_I2C_MAX_STEPS && fake_i2c_step(fake)) {
+		++steps;
+	}
+	return steps;
+}
+
+void fake_i2c_wait(fake_i2c* fake, i2c_xfer* xfer)
+{
+	for (uint32_t i = 0; i < FAKE_I2C_MAX_WAITS && i2c_xfer_pending(xfer); ++i) {
+		fake_i2c_run(fake);
+		i2c_bus_check_timeout(fake->bus);
+	}
+}
+
+void fake_i2c_clear_log(fake_i2c* fake)
+{
+	fake->log[0] = '\0';
+	fake->log_len = 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * fake_i2c.h
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+// Register level fake of the STM32L4 I2C master, plays the part of the hardware against an I2C_TypeDef in RAM.
+// Each step takes the bus one byte further, raising the flags the real peripheral would & calling the driver's
+// event/error handlers whenever the matching interrupt is enabled in CR1. Slaves are register files with an
+// auto incrementing pointer, like the ADT7420
+
+#ifndef FAKE_I2C_H_
+#define FAKE_I2C_H_
+
+#include "i2c_bus.h"
+
+#define FAKE_I2C_MAX_SLAVES 4U
+#define FAKE_I2C_NUM_REGS 16U
+#define FAKE_I2C_LOG_SIZE 512U
+// TXDR is 8 bits, anything wider left in it means the driver never wrote the byte
+#define FAKE_I2C_TXDR_EMPTY 0xFFFFFFFFU
+
+typedef enum {
+	FAKE_I2C_FAULT_NONE,
+	FAKE_I2C_FAULT_NACK, // Slave NACKs the byte
+	FAKE_I2C_FAULT_BERR, // Misplaced START/STOP during the byte
+	FAKE_I2C_FAULT_ARLO, // Another master wins the byte
+	FAKE_I2C_FAULT_TIMEOUT, // Slave stretches SCL past TIMEOUTA, the TIMEOUT flag is raised
+	FAKE_I2C_FAULT_STUCK // Slave holds the bus & no more events come until the peripheral is reset
+} Fake_i2c_fault;
+
+typedef enum {
+	FAKE_I2C_IDLE,
+	FAKE_I2C_WRITE,
+	FAKE_I2C_READ,
+	FAKE_I2C_WAIT_TC, // Software end, waiting for a restart or STOP
+	FAKE_I2C_OTHER_MASTER, // Lost arbitration, the bus stays busy until the winner's STOP
+	FAKE_I2C_STUCK
+} Fake_i2c_state;
+
+typedef struct {
+	uint8_t addr;
+	bool present;
+	uint8_t regs[FAKE_I2C_NUM_REGS];
+	uint8_t ptr;
+	bool ptr_set; // First byte of each write is the register pointer
+} fake_i2c_slave;
+
+typedef struct {
+	I2C_TypeDef regs;
+	i2c_bus* bus;
+	fake_i2c_slave slaves[FAKE_I2C_MAX_SLAVES];
+	fake_i2c_slave* target;
+	Fake_i2c_state state;
+	bool read;
+	uint32_t remaining; // Bytes left of the NBYTES chunk
+	uint16_t byte_idx; // Byte of the current segment, 0 is the address
+	Fake_i2c_fault fault;
+	uint16_t fault_byte;
+	uint8_t fault_count; // How many more segments get the fault
+	uint32_t irqs;
+	uint32_t resets;
+	bool in_reset;
+	bool in_hook; // In an ISR or already stepping, the hardware doesn't run on inside itself
+	bool concurrent; // Steps the bus whenever the driver looks at the clock, off to single step a test by hand
+	char log[FAKE_I2C_LOG_SIZE]; // Bus trace, e.g. "S48w 03 11 Sr48r 22 P"
+	uint16_t log_len;
+} fake_i2c;
+
+// Also installs the time hook that runs the bus alongside the driver's busy waits, so only one fake at a time
+void fake_i2c_init(fake_i2c* fake, i2c_bus* bus);
+fake_i2c_slave* fake_i2c_add_slave(fake_i2c* fake, uint8_t addr);
+// Fault hits byte n of the next count segments (0 is the address byte)
+void fake_i2c_inject(fake_i2c* fake, Fake_i2c_fault fault, uint16_t byte_idx, uint8_t count);
+// One bus event, false once there is nothing left for the hardware to do
+bool fake_i2c_step(fake_i2c* fake);
+// Steps until the bus goes quiet, returns the number of steps
+uint32_t fake_i2c_run(fake_i2c* fake);
+// Runs the bus & services it from "thread context" like the firmware's wait loops, until the transfer is done
+void fake_i2c_wait(fake_i2c* fake, i2c_xfer* xfer);
+void fake_i2c_clear_log(fake_i2c* fake);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * dwt_timer.h
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+// Host build stand in for Core/Inc/dwt_timer.h, simulated time moves on by one cycle every time it's read
+// so busy waits still finish, & tests can jump it forward to hit a deadline
+
+#ifndef DWT_TIMER_H_
+#define DWT_TIMER_H_
+
+#include "main.h"
+#include <stdint.h>
+#include <stddef.h>
+
+extern uint32_t host_cycles;
+// Called whenever simulated time is read or moved on, so a fake peripheral can run alongside the driver's
+// busy waits & see what it did to the registers part way through
+extern void (*host_time_hook)(void);
+
+static inline void dwt_timer_init(void)
+{
+}
+
+static inline uint32_t dwt_timer_cycles(void)
+{
+	if (host_time_hook != NULL) {
+		host_time_hook();
+	}
+	return host_cycles++;
+}
+
+static inline uint32_t dwt_timer_elapsed(uint32_t start)
+{
+	return dwt_timer_cycles() - start;
+}
+
+static inline uint32_t dwt_timer_us_to_cycles(uint32_t us)
+{
+	return us * (SystemCoreClock / 1000000U);
+}
+
+static inline uint32_t dwt_timer_cycles_to_us(uint32_t cycles)
+{
+	return cycles / (SystemCoreClock / 1000000U);
+}
+
+static inline uint32_t dwt_timer_ns_to_cycles(uint32_t ns)
+{
+	return ((ns * (SystemCoreClock / 1000000U)) + 999U) / 1000U;
+}
+
+static inline void dwt_timer_delay_cycles(uint32_t cycles)
+{
+	host_cycles += cycles;
+	if (host_time_hook != NULL) {
+		host_time_hook();
+	}
+}
+
+static inline void dwt_timer_delay_us(uint32_t us)
+{
+	dwt_timer_delay_cycles(dwt_timer_us_to_cycles(us));
+}
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * host.c
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+// Globals & the few non inline LL calls the drivers need, shared by every host test
+
+#include "main.h"
+#include "dwt_timer.h"
+#include "host.h"
+
+uint32_t SystemCoreClock = HOST_CORE_CLOCK_HZ;
+uint32_t host_primask;
+uint32_t host_cycles;
+void (*host_time_hook)(void);
+uint32_t host_i2c_clock_hz = HOST_CORE_CLOCK_HZ;
+int test_failures;
+
+void host_set_primask(uint32_t primask)
+{
+	host_primask = primask;
+	if (primask == 0 && host_time_hook != NULL) {
+		host_time_hook();
+	}
+}
+
+uint32_t LL_RCC_GetI2CClockFreq(uint32_t I2CxSource)
+{
+	return host_i2c_clock_hz;
+}
+
+void LL_mDelay(uint32_t Delay)
+{
+	dwt_timer_delay_cycles(Delay * (SystemCoreClock / 1000U));
+}
+
+uint64_t host_now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000U) + (uint64_t)now.tv_nsec;
+}
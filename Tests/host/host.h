@@ -0,0 +1,23 @@
+/*
+ * host.h
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+#ifndef HOST_H_
+#define HOST_H_
+
+#include <stdint.h>
+#include <time.h>
+
+// MSI range 8, as SystemClock_Config leaves it
+#define HOST_CORE_CLOCK_HZ 16000000U
+
+extern uint32_t host_i2c_clock_hz; // Returned by LL_RCC_GetI2CClockFreq
+extern int test_failures;
+
+// Wall clock of the machine running the tests, these are host timings & say nothing about the Cortex-M4
+uint64_t host_now_ns(void);
+
+#endif
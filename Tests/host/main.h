@@ -0,0 +1,39 @@
+/*
+ * main.h
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+// Host build stand in for Core/Inc/main.h, the real LL headers with the few core intrinsics the drivers use
+// redirected to plain C, so the drivers run against peripheral structs in RAM
+
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#include "stm32l4xx.h"
+#include "stm32l4xx_ll_i2c.h"
+#include "stm32l4xx_ll_rcc.h"
+#include "stm32l4xx_ll_bus.h"
+#include "stm32l4xx_ll_system.h"
+#include "stm32l4xx_ll_exti.h"
+#include "stm32l4xx_ll_cortex.h"
+#include "stm32l4xx_ll_utils.h"
+#include "stm32l4xx_ll_dma.h"
+#include "stm32l4xx_ll_tim.h"
+#include "stm32l4xx_ll_gpio.h"
+
+extern uint32_t host_primask;
+// Unmasking lets a fake peripheral take the interrupts that went pending while they were masked
+void host_set_primask(uint32_t primask);
+
+#undef __get_PRIMASK
+#undef __set_PRIMASK
+#undef __disable_irq
+#undef __enable_irq
+#define __get_PRIMASK() (host_primask)
+#define __set_PRIMASK(primask) host_set_primask(primask)
+#define __disable_irq() (host_primask = 1U)
+#define __enable_irq() host_set_primask(0U)
+
+#endif
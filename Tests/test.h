@@ -0,0 +1,36 @@
+/*
+ * test.h
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <stdio.h>
+#include "host.h"
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		++test_failures; \
+	} \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+	long long a_ = (long long)(a); \
+	long long b_ = (long long)(b); \
+	if (a_ != b_) { \
+		printf("%s:%d: CHECK_EQ(%s, %s) failed, %lld != %lld\n", __FILE__, __LINE__, #a, #b, a_, b_); \
+		++test_failures; \
+	} \
+} while (0)
+
+#define RUN_TEST(fn) do { \
+	int before_ = test_failures; \
+	fn(); \
+	printf("%s %s\n", test_failures == before_ ? "PASS" : "FAIL", #fn); \
+} while (0)
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * test_adt7420_decode.c
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+// Every one of the 65536 ADC codes through both resolution decoders, against a double reference, plus the
+// host time per code of the milli degree & float paths. The driver is included whole to reach its statics
+
+#include <math.h>
+#include "test.h"
+#include "../Core/Src/adt7420_driver.c"
+
+#define TEST_NUM_CODES 65536U
+#define TEST_BENCH_PASSES 200U
+
+// 13 bit: two's complement in the top 13 bits, 1 LSB = 0.0625C, the three flag bits below it are ignored
+static double reference_13_bit_c(uint16_t adc_code)
+{
+	return floor((double)(int16_t)adc_code / 8.0) * 0.0625;
+}
+
+// 16 bit: 1 LSB = 0.0078125C
+static double reference_16_bit_c(uint16_t adc_code)
+{
+	return (double)(int16_t)adc_code * 0.0078125;
+}
+
+static void check_decoder(const adt7420_decoder* decoder, double (*reference)(uint16_t adc_code))
+{
+	uint32_t c_errors = 0;
+	uint32_t mdeg_errors = 0;
+	uint32_t order_errors = 0;
+	int32_t last_mdeg = INT32_MIN;
+
+	// Signed order, so the decoded values should never go down
+	for (int32_t signed_code = INT16_MIN; signed_code <= INT16_MAX; ++signed_code) {
+		uint16_t adc_code = (uint16_t)signed_code;
+		double expected_c = reference(adc_code);
+		// Milli degrees truncate towards 0, the 16 bit LSB isn't a whole number of them
+		int32_t expected_mdeg = (int32_t)trunc(expected_c * 1000.0);
+		float temperature_c = decoder->to_celsius(adc_code);
+		int32_t temperature_mdeg = decoder->to_mdeg(adc_code);
+
+		// Every value either resolution can produce is exact in a float
+		if ((double)temperature_c != expected_c) {
+			if (c_errors++ == 0) {
+				printf("code 0x%04X: %f C, expected %f\n", adc_code, temperature_c, expected_c);
+			}
+		}
+		if (temperature_mdeg != expected_mdeg) {
+			if (mdeg_errors++ == 0) {
+				printf("code 0x%04X: %d mC, expected %d\n", adc_code, temperature_mdeg, expected_mdeg);
+			}
+		}
+		if (temperature_mdeg < last_mdeg) {
+			++order_errors;
+		}
+		last_mdeg = temperature_mdeg;
+	}
+	CHECK_EQ(c_errors, 0);
+	CHECK_EQ(mdeg_errors, 0);
+	CHECK_EQ(order_errors, 0);
+}
+
+static void test_13_bit_exhaustive(void)
+{
+	check_decoder(&adt7420_decoder_13_bit, reference_13_bit_c);
+	// Datasheet table 5 points
+	CHECK_EQ(adt7420_decoder_13_bit.to_mdeg(0xE480U), -55000);
+	CHECK_EQ(adt7420_decoder_13_bit.to_mdeg(0xFFF8U), -62);
+	CHECK_EQ(adt7420_decoder_13_bit.to_mdeg(0x0008U), 62);
+	CHECK_EQ(adt7420_decoder_13_bit.to_mdeg(0x4B00U), 150000);
+}
+
+static void test_16_bit_exhaustive(void)
+{
+	check_decoder(&adt7420_decoder_16_bit, reference_16_bit_c);
+	CHECK_EQ(adt7420_decoder_16_bit.to_mdeg(0xE480U), -55000);
+	CHECK_EQ(adt7420_decoder_16_bit.to_mdeg(0xFFFFU), -7);
+	CHECK_EQ(adt7420_decoder_16_bit.to_mdeg(0x0001U), 7);
+	CHECK_EQ(adt7420_decoder_16_bit.to_mdeg(0x4B00U), 150000);
+}
+
+// The old bit 7 guess read these 16 bit codes as 13 bit, the resolution now comes from the config alone
+static void test_resolution_from_config(void)
+{
+	uint32_t guessed_wrong = 0;
+
+	CHECK(adt7420_select_decoder(ADT7420_16_BIT_RES) == &adt7420_decoder_16_bit);
+	CHECK(adt7420_select_decoder(0) == &adt7420_decoder_13_bit);
+	for (uint32_t adc_code = 0; adc_code < TEST_NUM_CODES; ++adc_code) {
+		if (!(adc_code & 0x80U) && adt7420_decode_16_bit_mdeg(adc_code) != adt7420_decode_13_bit_mdeg(adc_code)) {
+			++guessed_wrong;
+		}
+	}
+	printf("%u of %u codes were misread by the bit 7 guess in 16 bit mode\n", guessed_wrong, TEST_NUM_CODES);
+	CHECK(guessed_wrong > 0);
+}
+
+// Whole degree limits encoded for the threshold registers decode back to the same temperature
+static void test_limit_round_trip(void)
+{
+	for (int16_t temperature_c = -55; temperature_c <= 150; ++temperature_c) {
+		uint16_t adc_code = adt7420_temperature_to_adc_code(ADT7420_16_BIT_RES, temperature_c);
+		CHECK_EQ(adt7420_decoder_16_bit.to_mdeg(adc_code), temperature_c * 1000);
+		adc_code = adt7420_temperature_to_adc_code(0, temperature_c);
+		CHECK_EQ(adt7420_decoder_13_bit.to_mdeg(adc_code), temperature_c * 1000);
+	}
+}
+
+// Through the decoder pointers as the driver calls them, the volatile keeps the loop from being folded away
+static double bench_ns_per_code(const adt7420_decoder* volatile* decoder, bool integer)
+{
+	volatile int32_t mdeg_sink = 0;
+	volatile float c_sink = 0.0f;
+	uint64_t start = host_now_ns();
+
+	for (uint32_t pass = 0; pass < TEST_BENCH_PASSES; ++pass) {
+		const adt7420_decoder* d = *decoder;
+		for (uint32_t adc_code = 0; adc_code < TEST_NUM_CODES; ++adc_code) {
+			if (integer) {
+				mdeg_sink = d->to_mdeg(adc_code);
+			} else {
+				c_sink = d->to_celsius(adc_code);
+			}
+		}
+	}
+	(void)mdeg_sink;
+	(void)c_sink;
+	return (double)(host_now_ns() - start) / ((double)TEST_BENCH_PASSES * TEST_NUM_CODES);
+}
+
+static void bench_decoders(void)
+{
+	const adt7420_decoder* volatile decoder = &adt7420_decoder_13_bit;
+	double mdeg_13 = bench_ns_per_code(&decoder, true);
+	double c_13 = bench_ns_per_code(&decoder, false);
+	decoder = &adt7420_decoder_16_bit;
+	double mdeg_16 = bench_ns_per_code(&decoder, true);
+	double c_16 = bench_ns_per_code(&decoder, false);
+
+	printf("host: 13 bit %.2fns mC / %.2fns C per code, 16 bit %.2fns mC / %.2fns C per code\n",
+		mdeg_13, c_13, mdeg_16, c_16);
+}
+
+int main(void)
+{
+	RUN_TEST(test_13_bit_exhaustive);
+	RUN_TEST(test_16_bit_exhaustive);
+	RUN_TEST(test_resolution_from_config);
+	RUN_TEST(test_limit_round_trip);
+	RUN_TEST(bench_decoders);
+	return test_failures != 0;
+}
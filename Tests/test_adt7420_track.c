@@ -0,0 +1,140 @@
+/*
+ * test_adt7420_track.c
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+// The tracking threshold window against an ADT7420 register file on the fake I2C bus, plus the INT pin polarity
+// following the config on the sensor rather than the shadow
+
+#include <string.h>
+#include "test.h"
+#include "fake_i2c.h"
+#include "adt7420_driver.h"
+
+#define TEST_ADDR 0x48U
+#define TEST_TIMEOUT_US 25000U
+#define TEST_DELTA_MDEG 500
+
+static i2c_bus bus;
+static fake_i2c fake;
+static fake_i2c_slave* sensor;
+static adt7420_dev dev;
+
+static uint16_t sensor_reg_two(uint8_t reg)
+{
+	return (uint16_t)((sensor->regs[reg] << 8U) | sensor->regs[reg + 1U]);
+}
+
+// 16 bit mode, 1 LSB = 1/128C
+static void sensor_set_temperature_mdeg(int32_t temperature_mdeg)
+{
+	uint16_t adc_code = (uint16_t)((temperature_mdeg * 128) / 1000);
+	sensor->regs[ADT7420_TEMPERATURE_MSB] = adc_code >> 8U;
+	sensor->regs[ADT7420_TEMPERATURE_LSB] = adc_code & 0xFFU;
+}
+
+static void setup(void)
+{
+	adt7420_settings params = {
+		.config = ADT7420_16_BIT_RES | ADT7420_INT_MODE | ADT7420_CONTINUOUS_MODE,
+		.crit_temperature_c = 30,
+		.high_temperature_c = 27,
+		.low_temperature_c = 18,
+		.hysteresis = 2
+	};
+
+	fake_i2c_init(&fake, &bus);
+	i2c_bus_init(&bus, &fake.regs);
+	// Blocking calls only look at the clock, so run the fake, while there's a deadline to check
+	i2c_bus_set_timeout(&bus, TEST_TIMEOUT_US);
+	sensor = fake_i2c_add_slave(&fake, TEST_ADDR);
+	sensor->regs[ADT7420_ID] = ADT7420_CHIP_ID;
+	sensor_set_temperature_mdeg(25000);
+
+	memset(&dev, 0, sizeof(dev));
+	dev.i2c_ch = &fake.regs;
+	dev.i2c_addr = TEST_ADDR;
+	dev.bus = &bus;
+	CHECK_EQ(adt7420_init(&dev, &params), ADT7420_OK);
+	CHECK_EQ(sensor->regs[ADT7420_HYSTERESIS], 2);
+}
+
+static void test_enable_clears_hysteresis(void)
+{
+	setup();
+	CHECK_EQ(adt7420_track_enable(&dev, TEST_DELTA_MDEG), ADT7420_OK);
+
+	// Any hysteresis would keep INT from re-arming inside a 0.5C window
+	CHECK_EQ(sensor->regs[ADT7420_HYSTERESIS], 0);
+	CHECK(!(sensor->regs[ADT7420_CONFIG] & ADT7420_COMP_MODE));
+	CHECK_EQ(sensor_reg_two(ADT7420_TEMPERATURE_HIGH_MSB), 0x0CC0); // 25.5C
+	CHECK_EQ(sensor_reg_two(ADT7420_TEMPERATURE_LOW_MSB), 0x0C40); // 24.5C
+	CHECK_EQ(dev.track_center_mdeg, 25000);
+}
+
+static void test_update_inside_window(void)
+{
+	setup();
+	CHECK_EQ(adt7420_track_enable(&dev, TEST_DELTA_MDEG), ADT7420_OK);
+	uint32_t transfers = bus.stats.transfers;
+
+	CHECK_EQ(adt7420_track_update(&dev, 25400), ADT7420_OK);
+	CHECK_EQ(bus.stats.transfers, transfers);
+	CHECK_EQ(dev.track_center_mdeg, 25000);
+}
+
+static void test_update_failed_sync_keeps_centre(void)
+{
+	setup();
+	CHECK_EQ(adt7420_track_enable(&dev, TEST_DELTA_MDEG), ADT7420_OK);
+
+	fake_i2c_inject(&fake, FAKE_I2C_FAULT_NACK, 0, 1);
+	CHECK_EQ(adt7420_track_update(&dev, 26000), ADT7420_I2C_NACK);
+	// The sensor still has the old window, so the centre has to stay with it
+	CHECK_EQ(dev.track_center_mdeg, 25000);
+	CHECK_EQ(sensor_reg_two(ADT7420_TEMPERATURE_HIGH_MSB), 0x0CC0);
+
+	// Next sample outside the window tries again
+	CHECK_EQ(adt7420_track_update(&dev, 26000), ADT7420_OK);
+	CHECK_EQ(dev.track_center_mdeg, 26000);
+	CHECK_EQ(sensor_reg_two(ADT7420_TEMPERATURE_HIGH_MSB), 0x0D40); // 26.5C
+	CHECK_EQ(sensor_reg_two(ADT7420_TEMPERATURE_LOW_MSB), 0x0CC0); // 25.5C
+}
+
+// INT is active low until the polarity change is actually on the sensor
+static void test_int_polarity_synced(void)
+{
+	GPIO_TypeDef port;
+
+	setup();
+	memset(&port, 0, sizeof(port));
+	dev.int_port = &port;
+	dev.int_pin = LL_GPIO_PIN_0;
+	CHECK(adt7420_int_asserted(&dev));
+
+	uint8_t config = sensor->regs[ADT7420_CONFIG] | ADT7420_INT_ACTIVE_HIGH;
+	CHECK_EQ(adt7420_set_config(&dev, config), ADT7420_OK);
+	CHECK(adt7420_is_dirty(&dev));
+	CHECK(adt7420_int_asserted(&dev));
+
+	fake_i2c_inject(&fake, FAKE_I2C_FAULT_NACK, 0, 1);
+	CHECK_EQ(adt7420_sync(&dev), ADT7420_I2C_NACK);
+	CHECK(adt7420_int_asserted(&dev));
+
+	CHECK_EQ(adt7420_sync(&dev), ADT7420_OK);
+	CHECK_EQ(sensor->regs[ADT7420_CONFIG], config);
+	CHECK(!adt7420_int_asserted(&dev));
+	port.IDR = LL_GPIO_PIN_0;
+	CHECK(adt7420_int_asserted(&dev));
+}
+
+int main(void)
+{
+	RUN_TEST(test_enable_clears_hysteresis);
+	RUN_TEST(test_update_inside_window);
+	RUN_TEST(test_update_failed_sync_keeps_centre);
+	RUN_TEST(test_int_polarity_synced);
+	return test_failures != 0;
+}
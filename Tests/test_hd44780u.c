@@ -0,0 +1,143 @@
+/*
+ * test_hd44780u.c
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+// The HD44780U driver against the controller model, with R/W tied low (fixed execution times, as the demo runs)
+// & with it fitted (busy flag polling), including a controller whose busy flag never clears
+
+#include <string.h>
+#include "test.h"
+#include "fake_hd44780.h"
+
+// Demo wiring, port B with the data pins out of order
+#define TEST_RW_PIN LL_GPIO_PIN_3
+#define TEST_INIT_LOG "30 30 30 20 28 08 01 06"
+
+static hd44780u display;
+static fake_hd44780 fake;
+
+static void setup(uint32_t rw_pin)
+{
+	memset(&display, 0, sizeof(display));
+	display.en_pin = LL_GPIO_PIN_4;
+	display.rs_pin = LL_GPIO_PIN_5;
+	display.rw_pin = rw_pin;
+	display.d4_pin = LL_GPIO_PIN_0;
+	display.d5_pin = LL_GPIO_PIN_7;
+	display.d6_pin = LL_GPIO_PIN_6;
+	display.d7_pin = LL_GPIO_PIN_1;
+	fake_hd44780_init(&fake, &display);
+	hd44780u_init(&display);
+}
+
+static void check_clean(void)
+{
+	CHECK_EQ(fake.busy_writes, 0);
+	CHECK_EQ(fake.contention, 0);
+	CHECK_EQ(fake.undriven, 0);
+}
+
+static void test_init_fixed_delays(void)
+{
+	setup(0);
+	CHECK(strcmp(fake.log, TEST_INIT_LOG) == 0);
+	CHECK(fake.four_bit);
+	CHECK_EQ(fake.status_reads, 0);
+	check_clean();
+
+	hd44780u_display_on(&display, HD44780U_CURSOR_OFF);
+	hd44780u_set_cursor(&display, 1, 2);
+	hd44780u_put_str(&display, "Hi", 2);
+	CHECK_EQ(fake.ddram[0x42], 'H');
+	CHECK_EQ(fake.ddram[0x43], 'i');
+	CHECK_EQ(fake.display_ctrl, HD44780U_DISPLAY_CTRL | HD44780U_DISPLAY_ON);
+	check_clean();
+}
+
+static void test_init_busy_flag(void)
+{
+	setup(TEST_RW_PIN);
+	CHECK(strcmp(fake.log, TEST_INIT_LOG) == 0);
+	// Function set onwards asks the controller first
+	CHECK(fake.status_reads >= 4);
+
+	hd44780u_display_clear(&display);
+	hd44780u_put_str(&display, "Temp", 4);
+	CHECK(memcmp(fake.ddram, "Temp", 4) == 0);
+	check_clean();
+}
+
+// A controller quicker than the datasheet's worst case is only waited on for as long as it's actually busy
+static void test_busy_flag_faster(void)
+{
+	uint32_t cycles[2];
+
+	for (uint32_t rw = 0; rw < 2U; ++rw) {
+		setup(rw ? TEST_RW_PIN : 0);
+		fake.exec_us = 20U;
+		fake.clear_home_us = 700U;
+		uint32_t start = host_cycles;
+		hd44780u_display_clear(&display);
+		hd44780u_put_str(&display, "0123456789ABCDEF", 16);
+		cycles[rw] = host_cycles - start;
+		CHECK_EQ(fake.ddram[0xF], 'F');
+		check_clean();
+	}
+	printf("clear + 16 characters: %uus on fixed delays, %uus polling the busy flag\n",
+		dwt_timer_cycles_to_us(cycles[0]), dwt_timer_cycles_to_us(cycles[1]));
+	CHECK(cycles[1] < cycles[0]);
+}
+
+// The model holds the old address for a few us after BF clears, as the controller does
+static void test_get_address(void)
+{
+	uint8_t addr = 0;
+
+	setup(0);
+	CHECK_EQ(hd44780u_get_address(&display, &addr), HD44780U_NO_RW_PIN);
+
+	setup(TEST_RW_PIN);
+	hd44780u_set_cursor(&display, 1, 3);
+	hd44780u_put_char(&display, 'A');
+	hd44780u_put_char(&display, 'B');
+	CHECK_EQ(hd44780u_get_address(&display, &addr), HD44780U_OK);
+	CHECK_EQ(addr, 0x45);
+	CHECK(!(hd44780u_read_status(&display) & HD44780U_BUSY_FLAG));
+	check_clean();
+}
+
+// A controller stuck busy costs each write the busy timeout & the write is lost, but nothing hangs
+static void test_busy_timeout(void)
+{
+	setup(TEST_RW_PIN);
+	fake.stuck_busy = true;
+	CHECK(hd44780u_read_status(&display) & HD44780U_BUSY_FLAG);
+
+	uint32_t start = host_cycles;
+	hd44780u_write_data(&display, 'X');
+	uint32_t elapsed_us = dwt_timer_cycles_to_us(host_cycles - start);
+	printf("write to a stuck controller returned after %uus\n", elapsed_us);
+	CHECK(elapsed_us >= HD44780U_BUSY_TIMEOUT_US);
+	CHECK(elapsed_us < HD44780U_BUSY_TIMEOUT_US + 100U);
+	CHECK_EQ(fake.busy_writes, 1);
+	CHECK(fake.ddram[0] != 'X');
+
+	// Once it recovers the next write goes straight through
+	fake.stuck_busy = false;
+	hd44780u_write_data(&display, 'Y');
+	CHECK_EQ(fake.ddram[0], 'Y');
+	CHECK_EQ(fake.busy_writes, 1);
+}
+
+int main(void)
+{
+	RUN_TEST(test_init_fixed_delays);
+	RUN_TEST(test_init_busy_flag);
+	RUN_TEST(test_busy_flag_faster);
+	RUN_TEST(test_get_address);
+	RUN_TEST(test_busy_timeout);
+	return test_failures != 0;
+}
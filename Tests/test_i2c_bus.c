@@ -0,0 +1,531 @@
+/*
+ * test_i2c_bus.c
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+// The interrupt driven I2C engine & the ADT7420 submit/complete calls against the register level fake
+
+#include <string.h>
+#include "test.h"
+#include "fake_i2c.h"
+#include "adt7420_driver.h"
+
+#define TEST_ADDR 0x48U
+#define TEST_ABSENT_ADDR 0x4BU
+#define TEST_BENCH_RUNS 100000U
+#define TEST_TIMEOUT_US 25000U
+
+static i2c_bus bus;
+static fake_i2c fake;
+static fake_i2c_slave* slave;
+
+static void setup(void)
+{
+	fake_i2c_init(&fake, &bus);
+	i2c_bus_init(&bus, &fake.regs);
+	slave = fake_i2c_add_slave(&fake, TEST_ADDR);
+}
+
+static void xfer_init(i2c_xfer* xfer, uint8_t addr, uint8_t* tx, uint16_t tx_len, uint8_t* rx, uint16_t rx_len)
+{
+	memset(xfer, 0, sizeof(*xfer));
+	xfer->addr = addr;
+	xfer->tx_buf = tx;
+	xfer->tx_len = tx_len;
+	xfer->rx_buf = rx;
+	xfer->rx_len = rx_len;
+	xfer->priority = I2C_PRIORITY_SAMPLE;
+}
+
+static void test_write(void)
+{
+	uint8_t tx[] = {0x04, 0x12, 0x34};
+	i2c_xfer xfer;
+
+	setup();
+	xfer_init(&xfer, TEST_ADDR, tx, sizeof(tx), NULL, 0);
+	CHECK_EQ(i2c_bus_submit(&bus, &xfer), I2C_OK);
+	CHECK_EQ(xfer.status, I2C_PENDING);
+	fake_i2c_wait(&fake, &xfer);
+
+	CHECK_EQ(xfer.status, I2C_OK);
+	CHECK(strcmp(fake.log, "S48w 04 12 34 P") == 0);
+	CHECK_EQ(slave->regs[4], 0x12);
+	CHECK_EQ(slave->regs[5], 0x34);
+	CHECK(i2c_bus_idle(&bus));
+	CHECK_EQ(bus.stats.transfers, 1);
+	// Completion disables every interrupt, so a stray event can't touch the next transfer
+	CHECK_EQ(fake.regs.CR1 & (I2C_CR1_TXIE | I2C_CR1_RXIE | I2C_CR1_TCIE | I2C_CR1_STOPIE), 0);
+}
+
+static void test_write_then_read(void)
+{
+	uint8_t tx[] = {0x00};
+	uint8_t rx[3] = {0};
+	i2c_xfer xfer;
+
+	setup();
+	slave->regs[0] = 0x0C;
+	slave->regs[1] = 0x80;
+	slave->regs[2] = 0x10;
+	xfer_init(&xfer, TEST_ADDR, tx, sizeof(tx), rx, sizeof(rx));
+	CHECK_EQ(i2c_bus_submit(&bus, &xfer), I2C_OK);
+	fake_i2c_wait(&fake, &xfer);
+
+	CHECK_EQ(xfer.status, I2C_OK);
+	CHECK(strcmp(fake.log, "S48w 00 Sr48r 0C 80 10 P") == 0);
+	CHECK_EQ(rx[0], 0x0C);
+	CHECK_EQ(rx[1], 0x80);
+	CHECK_EQ(rx[2], 0x10);
+}
+
+// Longer than NBYTES, so the segment is carried on with RELOAD & no START or STOP in between
+static void test_reload(void)
+{
+	uint8_t tx[300];
+	i2c_xfer xfer;
+
+	setup();
+	memset(tx, 0xA5, sizeof(tx));
+	tx[0] = 0x01;
+	xfer_init(&xfer, TEST_ADDR, tx, sizeof(tx), NULL, 0);
+	CHECK_EQ(i2c_bus_submit(&bus, &xfer), I2C_OK);
+	fake_i2c_wait(&fake, &xfer);
+
+	CHECK_EQ(xfer.status, I2C_OK);
+	CHECK(strncmp(fake.log, "S48w 01 A5", 10) == 0);
+	CHECK(strstr(fake.log, "Sr") == NULL);
+	CHECK_EQ(slave->regs[1], 0xA5);
+}
+
+static void test_chain(void)
+{
+	uint8_t tx_a[] = {0x00};
+	uint8_t rx_a[2] = {0};
+	uint8_t tx_b[] = {0x00};
+	uint8_t rx_b[2] = {0};
+	i2c_xfer a;
+	i2c_xfer b;
+	fake_i2c_slave* other;
+
+	setup();
+	other = fake_i2c_add_slave(&fake, 0x49U);
+	slave->regs[0] = 0x11;
+	other->regs[0] = 0x22;
+	xfer_init(&a, TEST_ADDR, tx_a, sizeof(tx_a), rx_a, sizeof(rx_a));
+	xfer_init(&b, 0x49U, tx_b, sizeof(tx_b), rx_b, sizeof(rx_b));
+	a.next = &b;
+	CHECK_EQ(i2c_bus_submit(&bus, &a), I2C_OK);
+	fake_i2c_wait(&fake, &b);
+
+	CHECK_EQ(a.status, I2C_OK);
+	CHECK_EQ(b.status, I2C_OK);
+	CHECK_EQ(rx_a[0], 0x11);
+	CHECK_EQ(rx_b[0], 0x22);
+	// One STOP for the whole chain
+	CHECK(strcmp(fake.log, "S48w 00 Sr48r 11 00 Sr49w 00 Sr49r 22 00 P") == 0);
+}
+
+static void test_queue(void)
+{
+	uint8_t tx_a[] = {0x04, 0x01};
+	uint8_t tx_b[] = {0x06, 0x02};
+	uint8_t tx_c[] = {0x08, 0x03};
+	i2c_xfer a;
+	i2c_xfer b;
+	i2c_xfer c;
+
+	setup();
+	xfer_init(&a, TEST_ADDR, tx_a, sizeof(tx_a), NULL, 0);
+	xfer_init(&b, TEST_ADDR, tx_b, sizeof(tx_b), NULL, 0);
+	xfer_init(&c, TEST_ADDR, tx_c, sizeof(tx_c), NULL, 0);
+	c.priority = I2C_PRIORITY_ALARM;
+	CHECK_EQ(i2c_bus_submit(&bus, &a), I2C_OK);
+	CHECK_EQ(i2c_bus_submit(&bus, &b), I2C_OK);
+	CHECK_EQ(i2c_bus_submit(&bus, &c), I2C_OK);
+	CHECK_EQ(i2c_bus_submit(&bus, &c), I2C_BUSY);
+	fake_i2c_wait(&fake, &b);
+
+	CHECK_EQ(a.status, I2C_OK);
+	CHECK_EQ(b.status, I2C_OK);
+	CHECK_EQ(c.status, I2C_OK);
+	// The alarm read jumps the queued sample
+	CHECK(strcmp(fake.log, "S48w 04 01 P S48w 08 03 P S48w 06 02 P") == 0);
+}
+
+static void test_nack_address(void)
+{
+	uint8_t tx[] = {0x00};
+	uint8_t rx[2];
+	i2c_xfer xfer;
+
+	setup();
+	xfer_init(&xfer, TEST_ABSENT_ADDR, tx, sizeof(tx), rx, sizeof(rx));
+	CHECK_EQ(i2c_bus_submit(&bus, &xfer), I2C_OK);
+	fake_i2c_wait(&fake, &xfer);
+
+	CHECK_EQ(xfer.status, I2C_NACK);
+	CHECK(strcmp(fake.log, "S4Bw N P") == 0);
+	CHECK_EQ(bus.stats.nacks, 1);
+	CHECK(i2c_bus_idle(&bus));
+}
+
+static void test_nack_data(void)
+{
+	uint8_t tx[] = {0x04, 0x12, 0x34};
+	i2c_xfer xfer;
+
+	setup();
+	fake_i2c_inject(&fake, FAKE_I2C_FAULT_NACK, 2, 1);
+	xfer_init(&xfer, TEST_ADDR, tx, sizeof(tx), NULL, 0);
+	CHECK_EQ(i2c_bus_submit(&bus, &xfer), I2C_OK);
+	fake_i2c_wait(&fake, &xfer);
+
+	CHECK_EQ(xfer.status, I2C_NACK);
+	CHECK(strcmp(fake.log, "S48w 04 12 N P") == 0);
+	// A NACK is the slave's answer, not a bus fault, so there's no retry
+	CHECK_EQ(bus.stats.retries, 0);
+}
+
+// Address only probes chained like a scan batch, one that NACKs part way through still lets the rest run
+static void test_probe_chain(void)
+{
+	i2c_xfer probes[4];
+
+	setup();
+	fake_i2c_add_slave(&fake, 0x4AU);
+	for (uint8_t i = 0; i < 4U; ++i) {
+		xfer_init(&probes[i], TEST_ADDR + i, NULL, 0, NULL, 0);
+		if (i) {
+			probes[i - 1U].next = &probes[i];
+		}
+	}
+	CHECK_EQ(i2c_bus_submit(&bus, probes), I2C_OK);
+	fake_i2c_wait(&fake, &probes[3]);
+
+	CHECK_EQ(probes[0].status, I2C_OK);
+	CHECK_EQ(probes[1].status, I2C_NACK);
+	CHECK_EQ(probes[2].status, I2C_OK);
+	CHECK_EQ(probes[3].status, I2C_NACK);
+	CHECK(strcmp(fake.log, "S48w Sr49w N P S4Aw Sr4Bw N P") == 0);
+}
+
+// A full range scan never puts a reserved address on the bus
+static void test_scan_clamped(void)
+{
+	uint8_t found[4];
+
+	setup();
+	fake_i2c_add_slave(&fake, 0x03);
+	fake_i2c_add_slave(&fake, 0x7C);
+	CHECK_EQ(i2c_bus_scan(&bus, 0x00, 0x7F, found, sizeof(found)), 1);
+	CHECK_EQ(found[0], TEST_ADDR);
+	CHECK(strncmp(fake.log, "S08w", 4) == 0);
+	CHECK(strstr(fake.log, "03w") == NULL);
+
+	fake_i2c_clear_log(&fake);
+	CHECK_EQ(i2c_bus_scan(&bus, 0x76, 0xFF, found, sizeof(found)), 0);
+	CHECK(strcmp(fake.log, "S76w N P S77w N P") == 0);
+}
+
+static void test_bus_error_retried(void)
+{
+	uint8_t tx[] = {0x04, 0x12, 0x34};
+	i2c_xfer xfer;
+
+	setup();
+	fake_i2c_inject(&fake, FAKE_I2C_FAULT_BERR, 2, 1);
+	xfer_init(&xfer, TEST_ADDR, tx, sizeof(tx), NULL, 0);
+	CHECK_EQ(i2c_bus_submit(&bus, &xfer), I2C_OK);
+	fake_i2c_run(&fake);
+
+	// The ISR only marks the recovery, it runs on the next check
+	CHECK(i2c_xfer_pending(&xfer));
+	CHECK(bus.recover_pending);
+	CHECK_EQ(fake.resets, 0);
+	CHECK(!i2c_bus_idle(&bus));
+	fake_i2c_wait(&fake, &xfer);
+
+	CHECK_EQ(xfer.status, I2C_OK);
+	CHECK(!bus.recover_pending);
+	CHECK_EQ(fake.resets, 1);
+	CHECK(strcmp(fake.log, "S48w 04 E R S48w 04 12 34 P") == 0);
+	CHECK_EQ(bus.stats.retries, 1);
+	CHECK_EQ(bus.stats.bus_errors, 0);
+	CHECK_EQ(slave->regs[5], 0x34);
+}
+
+static void test_bus_error_fails(void)
+{
+	uint8_t tx[] = {0x04, 0x12, 0x34};
+	uint8_t tx_next[] = {0x06, 0x56};
+	i2c_xfer xfer;
+	i2c_xfer next;
+
+	setup();
+	fake_i2c_inject(&fake, FAKE_I2C_FAULT_BERR, 1, 2);
+	xfer_init(&xfer, TEST_ADDR, tx, sizeof(tx), NULL, 0);
+	xfer_init(&next, TEST_ADDR, tx_next, sizeof(tx_next), NULL, 0);
+	CHECK_EQ(i2c_bus_submit(&bus, &xfer), I2C_OK);
+	CHECK_EQ(i2c_bus_submit(&bus, &next), I2C_OK);
+	fake_i2c_wait(&fake, &next);
+
+	CHECK_EQ(xfer.status, I2C_BUS_ERROR);
+	CHECK_EQ(bus.stats.retries, 1);
+	CHECK_EQ(bus.stats.bus_errors, 1);
+	// The queue carries on behind the failed transfer, from a freshly reset peripheral
+	CHECK_EQ(next.status, I2C_OK);
+	CHECK_EQ(fake.resets, 2);
+	CHECK(strcmp(fake.log, "S48w E R S48w E R S48w 06 56 P") == 0);
+	CHECK_EQ(slave->regs[6], 0x56);
+}
+
+// An error interrupt with no error flag left to clear isn't a fault, the transfer carries on untouched
+static void test_spurious_error_irq(void)
+{
+	uint8_t tx[] = {0x02, 0x77};
+	i2c_xfer xfer;
+
+	setup();
+	fake.concurrent = false;
+	xfer_init(&xfer, TEST_ADDR, tx, sizeof(tx), NULL, 0);
+	CHECK_EQ(i2c_bus_submit(&bus, &xfer), I2C_OK);
+	i2c_bus_er_irq_handler(&bus);
+	CHECK(!bus.recover_pending);
+	CHECK_EQ(bus.stats.retries, 0);
+
+	fake_i2c_wait(&fake, &xfer);
+	CHECK_EQ(xfer.status, I2C_OK);
+	CHECK_EQ(fake.resets, 0);
+}
+
+static void test_scl_timeout_retried(void)
+{
+	uint8_t tx[] = {0x02, 0x77};
+	i2c_xfer xfer;
+
+	setup();
+	fake_i2c_inject(&fake, FAKE_I2C_FAULT_TIMEOUT, 1, 1);
+	xfer_init(&xfer, TEST_ADDR, tx, sizeof(tx), NULL, 0);
+	CHECK_EQ(i2c_bus_submit(&bus, &xfer), I2C_OK);
+	fake_i2c_wait(&fake, &xfer);
+
+	CHECK_EQ(xfer.status, I2C_OK);
+	CHECK(strcmp(fake.log, "S48w T R S48w 02 77 P") == 0);
+	CHECK_EQ(bus.stats.retries, 1);
+	CHECK_EQ(bus.stats.timeouts, 0);
+	CHECK_EQ(slave->regs[2], 0x77);
+}
+
+// Another master owns the bus, so no recovery clocks across its transfer & the queue waits for its STOP
+static void test_arbitration_lost(void)
+{
+	uint8_t tx[] = {0x02, 0x77};
+	uint8_t tx_next[] = {0x06, 0x56};
+	i2c_xfer xfer;
+	i2c_xfer next;
+
+	setup();
+	fake.concurrent = false;
+	fake_i2c_inject(&fake, FAKE_I2C_FAULT_ARLO, 0, 1);
+	xfer_init(&xfer, TEST_ADDR, tx, sizeof(tx), NULL, 0);
+	xfer_init(&next, TEST_ADDR, tx_next, sizeof(tx_next), NULL, 0);
+	CHECK_EQ(i2c_bus_submit(&bus, &xfer), I2C_OK);
+	CHECK_EQ(i2c_bus_submit(&bus, &next), I2C_OK);
+	CHECK(fake_i2c_step(&fake));
+
+	CHECK_EQ(xfer.status, I2C_ARB_LOST);
+	CHECK(!bus.recover_pending);
+	CHECK(i2c_xfer_pending(&next));
+	CHECK(!(fake.regs.CR2 & I2C_CR2_START));
+
+	fake_i2c_wait(&fake, &next);
+	CHECK_EQ(next.status, I2C_OK);
+	CHECK(strcmp(fake.log, "S48w A p S48w 06 56 P") == 0);
+	CHECK_EQ(fake.resets, 0);
+	CHECK_EQ(bus.stats.retries, 0);
+	CHECK_EQ(bus.stats.arb_losts, 1);
+	CHECK(i2c_bus_idle(&bus));
+}
+
+// Nothing polls here, the deadline timer's interrupt alone has to fail the transfer
+static void test_stuck_bus_deadline(void)
+{
+	uint8_t tx[] = {0x04, 0x12, 0x34};
+	uint8_t tx_next[] = {0x06, 0x56};
+	i2c_xfer xfer;
+	i2c_xfer next;
+	TIM_TypeDef tim;
+
+	setup();
+	memset(&tim, 0, sizeof(tim));
+	i2c_bus_set_timeout(&bus, TEST_TIMEOUT_US);
+	i2c_bus_set_deadline_timer(&bus, &tim);
+	CHECK(tim.DIER & TIM_DIER_UIE);
+	CHECK(tim.CR1 & TIM_CR1_OPM);
+	CHECK(!(tim.CR1 & TIM_CR1_CEN));
+
+	fake_i2c_inject(&fake, FAKE_I2C_FAULT_STUCK, 1, 1);
+	xfer_init(&xfer, TEST_ADDR, tx, sizeof(tx), NULL, 0);
+	CHECK_EQ(i2c_bus_submit(&bus, &xfer), I2C_OK);
+	CHECK(tim.CR1 & TIM_CR1_CEN);
+	CHECK_EQ(tim.ARR, TEST_TIMEOUT_US);
+	fake_i2c_run(&fake);
+	CHECK(i2c_xfer_pending(&xfer));
+	xfer_init(&next, TEST_ADDR, tx_next, sizeof(tx_next), NULL, 0);
+	CHECK_EQ(i2c_bus_submit(&bus, &next), I2C_OK);
+
+	// The counter reaching ARR, one pulse mode stops it
+	host_cycles += dwt_timer_us_to_cycles(TEST_TIMEOUT_US + 1U);
+	tim.CR1 &= ~TIM_CR1_CEN;
+	tim.SR |= TIM_SR_UIF;
+	i2c_bus_deadline_irq_handler(&bus);
+
+	CHECK_EQ(xfer.status, I2C_TIMEOUT);
+	CHECK(!(tim.SR & TIM_SR_UIF));
+	CHECK_EQ(bus.stats.timeouts, 1);
+	// The recovery waits for thread context, the queued transfer waits for the recovery
+	CHECK_EQ(fake.resets, 0);
+	CHECK(i2c_xfer_pending(&next));
+	i2c_bus_check_timeout(&bus);
+	CHECK_EQ(fake.resets, 1);
+	fake_i2c_wait(&fake, &next);
+	CHECK_EQ(next.status, I2C_OK);
+	CHECK_EQ(slave->regs[6], 0x56);
+	CHECK(!(tim.CR1 & TIM_CR1_CEN));
+}
+
+// Past one lap of the 16 bit timer the interrupt re-arms for what's left instead of failing early
+static void test_long_deadline_rearms(void)
+{
+	uint8_t tx[] = {0x04, 0x12};
+	i2c_xfer xfer;
+	TIM_TypeDef tim;
+
+	setup();
+	memset(&tim, 0, sizeof(tim));
+	i2c_bus_set_timeout(&bus, 100000U);
+	i2c_bus_set_deadline_timer(&bus, &tim);
+	fake_i2c_inject(&fake, FAKE_I2C_FAULT_STUCK, 1, 1);
+	xfer_init(&xfer, TEST_ADDR, tx, sizeof(tx), NULL, 0);
+	CHECK_EQ(i2c_bus_submit(&bus, &xfer), I2C_OK);
+	fake_i2c_run(&fake);
+	CHECK_EQ(tim.ARR, I2C_BUS_DEADLINE_MAX_US - 1U);
+
+	host_cycles += dwt_timer_us_to_cycles(I2C_BUS_DEADLINE_MAX_US);
+	tim.SR |= TIM_SR_UIF;
+	i2c_bus_deadline_irq_handler(&bus);
+	CHECK(i2c_xfer_pending(&xfer));
+	CHECK(tim.CR1 & TIM_CR1_CEN);
+	CHECK(tim.ARR <= 100000U - I2C_BUS_DEADLINE_MAX_US + 1U);
+
+	host_cycles += dwt_timer_us_to_cycles(tim.ARR + 1U);
+	tim.SR |= TIM_SR_UIF;
+	i2c_bus_deadline_irq_handler(&bus);
+	CHECK_EQ(xfer.status, I2C_TIMEOUT);
+	i2c_bus_check_timeout(&bus);
+	CHECK_EQ(fake.resets, 1);
+	CHECK(i2c_bus_idle(&bus));
+}
+
+static void test_adt7420_submit_complete(void)
+{
+	adt7420_dev dev;
+	uint16_t data = 0;
+
+	setup();
+	memset(&dev, 0, sizeof(dev));
+	dev.i2c_ch = &fake.regs;
+	dev.i2c_addr = TEST_ADDR;
+	dev.bus = &bus;
+	i2c_stats_reset(&dev.stats);
+	slave->regs[ADT7420_TEMPERATURE_HIGH_MSB] = 0x20;
+	slave->regs[ADT7420_TEMPERATURE_HIGH_LSB] = 0x00;
+
+	CHECK_EQ(adt7420_submit_read_two_reg(&dev, ADT7420_TEMPERATURE_HIGH_MSB), ADT7420_OK);
+	CHECK(!adt7420_xfer_complete(&dev));
+	CHECK_EQ(adt7420_submit_read_two_reg(&dev, ADT7420_TEMPERATURE_HIGH_MSB), ADT7420_BUSY);
+	fake_i2c_run(&fake);
+	CHECK(adt7420_xfer_complete(&dev));
+	CHECK_EQ(adt7420_complete_read_two_reg(&dev, &data), ADT7420_OK);
+	CHECK_EQ(data, 0x2000);
+	CHECK_EQ(dev.stats.transfers, 1);
+
+	CHECK_EQ(adt7420_submit_write_two_reg(&dev, ADT7420_TEMPERATURE_LOW_MSB, 0x0A80), ADT7420_OK);
+	fake_i2c_run(&fake);
+	CHECK_EQ(adt7420_complete_write_two_reg(&dev), ADT7420_OK);
+	CHECK_EQ(slave->regs[ADT7420_TEMPERATURE_LOW_MSB], 0x0A);
+	CHECK_EQ(slave->regs[ADT7420_TEMPERATURE_LOW_LSB], 0x80);
+}
+
+// Polled calls have no queue, but a stuck bus still gets the bus's 9 clock recovery
+static void test_adt7420_polled_recovery(void)
+{
+	adt7420_dev dev;
+	GPIO_TypeDef port;
+
+	setup();
+	memset(&dev, 0, sizeof(dev));
+	memset(&port, 0, sizeof(port));
+	dev.i2c_ch = &fake.regs;
+	dev.i2c_addr = TEST_ADDR;
+	dev.recovery = &bus;
+	i2c_stats_reset(&dev.stats);
+	i2c_bus_set_recovery_pins(&bus, &port, LL_GPIO_PIN_6, LL_GPIO_PIN_7);
+
+	fake_i2c_inject(&fake, FAKE_I2C_FAULT_STUCK, 1, 1);
+	CHECK_EQ(adt7420_write_one_reg(&dev, ADT7420_CONFIG, 0x80), ADT7420_I2C_TIMEOUT);
+	CHECK(strcmp(fake.log, "S48w X R") == 0);
+	CHECK_EQ(fake.resets, 1);
+	CHECK_EQ(fake.state, FAKE_I2C_IDLE);
+	CHECK_EQ(dev.stats.timeouts, 1);
+	// Pins handed back to the peripheral once clocked out
+	CHECK_EQ(port.MODER, (LL_GPIO_MODE_ALTERNATE << 12U) | (LL_GPIO_MODE_ALTERNATE << 14U));
+}
+
+// Host CPU time through the state machine for a register read, the bus itself takes no time in the fake
+static void bench_write_then_read(void)
+{
+	uint8_t tx[] = {0x00};
+	uint8_t rx[2];
+	i2c_xfer xfer;
+
+	setup();
+	xfer_init(&xfer, TEST_ADDR, tx, sizeof(tx), rx, sizeof(rx));
+	uint64_t start = host_now_ns();
+	for (uint32_t i = 0; i < TEST_BENCH_RUNS; ++i) {
+		fake_i2c_clear_log(&fake);
+		i2c_bus_submit(&bus, &xfer);
+		fake_i2c_run(&fake);
+	}
+	uint64_t elapsed = host_now_ns() - start;
+	CHECK_EQ(xfer.status, I2C_OK);
+	printf("host: %.0fns per write-then-read, %u interrupts each\n", (double)elapsed / TEST_BENCH_RUNS,
+		fake.irqs / TEST_BENCH_RUNS);
+}
+
+int main(void)
+{
+	RUN_TEST(test_write);
+	RUN_TEST(test_write_then_read);
+	RUN_TEST(test_reload);
+	RUN_TEST(test_chain);
+	RUN_TEST(test_queue);
+	RUN_TEST(test_nack_address);
+	RUN_TEST(test_nack_data);
+	RUN_TEST(test_probe_chain);
+	RUN_TEST(test_scan_clamped);
+	RUN_TEST(test_bus_error_retried);
+	RUN_TEST(test_bus_error_fails);
+	RUN_TEST(test_spurious_error_irq);
+	RUN_TEST(test_scl_timeout_retried);
+	RUN_TEST(test_arbitration_lost);
+	RUN_TEST(test_stuck_bus_deadline);
+	RUN_TEST(test_long_deadline_rearms);
+	RUN_TEST(test_adt7420_submit_complete);
+	RUN_TEST(test_adt7420_polled_recovery);
+	RUN_TEST(bench_write_then_read);
+	return test_failures != 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * test_i2c_timing.c
+ *
+ *  Created on: Oct 3, 2020
+ *      Author: Tom
+ */
+
+// i2c_bus_compute_timing across kernel clocks, every TIMINGR it gives decoded back & held to the I2C spec (SCLDEL
+// against the data setup time, SDADEL against the data hold & valid times) & the reference manual's sampling limits,
+// plus the values the demo runs with pinned
+
+#include "test.h"
+#include "i2c_bus.h"
+
+#define TEST_CLOCK_MIN_HZ 1000000U
+#define TEST_CLOCK_MAX_HZ 80000000U
+#define TEST_CLOCK_STEP_HZ 250000U
+
+// Same limits as the driver's table, in ps here to keep the checks exact
+typedef struct {
+	const char* name;
+	int64_t t_scl;
+	int64_t t_low_min;
+	int64_t t_high_min;
+	int64_t t_su_dat_min;
+	int64_t t_hd_dat_min;
+	int64_t t_vd_dat_max;
+	int64_t t_r;
+	int64_t t_f;
+} test_spec;
+
+static const test_spec test_specs[I2C_NUM_SPEEDS] = {
+	[I2C_SPEED_STANDARD] = {"standard", 10000000, 4700000, 4000000, 250000, 0, 3450000, 1000000, 300000},
+	[I2C_SPEED_FAST] = {"fast", 2500000, 1300000, 600000, 100000, 0, 900000, 300000, 300000},
+	[I2C_SPEED_FAST_PLUS] = {"fast plus", 1000000, 500000, 260000, 50000, 0, 450000, 120000, 120000}
+};
+
+typedef struct {
+	int64_t t_presc;
+	int64_t t_low;
+	int64_t t_high;
+	int64_t t_period;
+	int64_t t_scldel;
+	int64_t t_sdadel;
+	int64_t t_hd_dat; // Shortest hold after SCL falls, tAF & the synchroniser at their quickest
+	int64_t t_vd_dat; // Longest until SDA is valid, tAF & the synchroniser at their slowest plus the rise
+} test_timing;
+
+static test_timing decode(uint32_t timing, uint32_t i2c_clk_hz, I2c_speed speed)
+{
+	const test_spec* spec = &test_specs[speed];
+	int64_t t_clk = 1000000000000LL / i2c_clk_hz;
+	int64_t t_presc = (int64_t)(((timing & I2C_TIMINGR_PRESC) >> I2C_TIMINGR_PRESC_Pos) + 1U) * t_clk;
+	int64_t t_sync = (I2C_BUS_TAF_MIN_NS * 1000LL) + (2 * t_clk);
+	test_timing t;
+
+	t.t_presc = t_presc;
+	t.t_low = (int64_t)(((timing & I2C_TIMINGR_SCLL) >> I2C_TIMINGR_SCLL_Pos) + 1U) * t_presc + t_sync;
+	t.t_high = (int64_t)(((timing & I2C_TIMINGR_SCLH) >> I2C_TIMINGR_SCLH_Pos) + 1U) * t_presc + t_sync;
+	t.t_period = t.t_low + t.t_high + spec->t_r + spec->t_f;
+	t.t_scldel = (int64_t)(((timing & I2C_TIMINGR_SCLDEL) >> I2C_TIMINGR_SCLDEL_Pos) + 1U) * t_presc;
+	t.t_sdadel = (int64_t)((timing & I2C_TIMINGR_SDADEL) >> I2C_TIMINGR_SDADEL_Pos) * t_presc;
+	t.t_hd_dat = t.t_sdadel + (I2C_BUS_TAF_MIN_NS * 1000LL) + ((I2C_BUS_DNF + 3) * t_clk) - spec->t_f;
+	t.t_vd_dat = t.t_sdadel + (I2C_BUS_TAF_MAX_NS * 1000LL) + ((I2C_BUS_DNF + 4) * t_clk) + spec->t_r;
+	return t;
+}
+
+static void check_speed(I2c_speed speed)
+{
+	const test_spec* spec = &test_specs[speed];
+	uint32_t lowest_hz = 0;
+	uint32_t errors = 0;
+	uint32_t vd_dat_over = 0;
+
+	for (uint32_t clk_hz = TEST_CLOCK_MIN_HZ; clk_hz <= TEST_CLOCK_MAX_HZ; clk_hz += TEST_CLOCK_STEP_HZ) {
+		uint32_t timing = i2c_bus_compute_timing(clk_hz, speed);
+		if (timing == 0) {
+			// Once a clock works, every faster one should too
+			if (lowest_hz != 0 && errors++ == 0) {
+				printf("%s: %uHz gave no timing, %uHz did\n", spec->name, clk_hz, lowest_hz);
+			}
+			continue;
+		}
+		if (lowest_hz == 0) {
+			lowest_hz = clk_hz;
+		}
+
+		int64_t t_clk = 1000000000000LL / clk_hz;
+		int64_t t_filters = (I2C_BUS_TAF_MAX_NS * 1000LL) + (I2C_BUS_DNF * t_clk);
+		test_timing t = decode(timing, clk_hz, speed);
+		bool ok = t.t_low >= spec->t_low_min && t.t_high >= spec->t_high_min && t.t_period >= spec->t_scl
+			&& t.t_scldel >= spec->t_r + spec->t_su_dat_min
+			&& (4 * t_clk) < (t.t_low - t_filters) && t_clk < t.t_high;
+		// No slower than the mode below, or it shouldn't have been offered
+		if (speed != I2C_SPEED_STANDARD) {
+			ok = ok && t.t_period < test_specs[speed - 1].t_scl;
+		}
+		// Data valid in time, except where the worst case filter & synchroniser delay alone overrun it & SDADEL is
+		// already 0. Held long enough, unless one more SDADEL step for the hold would break data valid
+		bool sdadel_zero = t.t_sdadel == 0;
+		ok = ok && (t.t_vd_dat <= spec->t_vd_dat_max || sdadel_zero);
+		ok = ok && (t.t_hd_dat >= spec->t_hd_dat_min || t.t_vd_dat + t.t_presc > spec->t_vd_dat_max);
+		vd_dat_over += t.t_vd_dat > spec->t_vd_dat_max;
+		if (!ok && errors++ == 0) {
+			printf("%s: %uHz gave 0x%08X, tLOW %lldps tHIGH %lldps period %lldps tHD;DAT %lldps tVD;DAT %lldps\n",
+				spec->name, clk_hz, timing, (long long)t.t_low, (long long)t.t_high, (long long)t.t_period,
+				(long long)t.t_hd_dat, (long long)t.t_vd_dat);
+		}
+	}
+	printf("%s: works from %uHz, %u clocks too slow for tVD;DAT at SDADEL 0\n", spec->name, lowest_hz, vd_dat_over);
+	CHECK_EQ(errors, 0);
+	CHECK(lowest_hz != 0);
+}
+
+static void test_standard(void)
+{
+	check_speed(I2C_SPEED_STANDARD);
+}
+
+static void test_fast(void)
+{
+	check_speed(I2C_SPEED_FAST);
+}
+
+static void test_fast_plus(void)
+{
+	check_speed(I2C_SPEED_FAST_PLUS);
+}
+
+// 16MHz MSI is what the demo runs PCLK1 & so I2C1 from
+static void test_demo_clock(void)
+{
+	CHECK_EQ(i2c_bus_compute_timing(16000000U, I2C_SPEED_FAST), 0x00610611U);
+	test_timing t = decode(0x00610611U, 16000000U, I2C_SPEED_FAST);
+	printf("16MHz fast: %.0fkHz with the spec's worst case rise & fall\n", 1e9 / (double)t.t_period);
+	CHECK(t.t_period > 2500000 && t.t_period < 2530000); // ~398kHz
+
+	// The reference manual's table has 16MHz fast mode plus, the old guard refused it
+	uint32_t timing = i2c_bus_compute_timing(16000000U, I2C_SPEED_FAST_PLUS);
+	CHECK_EQ(timing, 0x00200105U);
+	t = decode(timing, 16000000U, I2C_SPEED_FAST_PLUS);
+	printf("16MHz fast plus: %.0fkHz with the spec's worst case rise & fall\n", 1e9 / (double)t.t_period);
+
+	CHECK_EQ(i2c_bus_compute_timing(0, I2C_SPEED_FAST), 0);
+	CHECK_EQ(i2c_bus_compute_timing(16000000U, I2C_NUM_SPEEDS), 0);
+}
+
+int main(void)
+{
+	RUN_TEST(test_standard);
+	RUN_TEST(test_fast);
+	RUN_TEST(test_fast_plus);
+	RUN_TEST(test_demo_clock);
+	return test_failures != 0;
+}